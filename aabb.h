@@ -3,44 +3,46 @@
 
 #include "rayTracer.h"
 
-class aabb {
+template <typename T>
+class aabbT {
   public:
-    interval x, y, z;
+    intervalT<T> x, y, z;
 
-    aabb() {} // The default AABB is empty, since intervals are empty by default.
+    aabbT() {} // The default AABB is empty, since intervals are empty by default.
 
-    aabb(const interval& x, const interval& y, const interval& z) : x(x), y(y), z(z) {
+    aabbT(const intervalT<T>& x, const intervalT<T>& y, const intervalT<T>& z) : x(x), y(y), z(z) {
         padToMinimums();
     }
 
-    aabb(const point3& a, const point3& b) {
+    aabbT(const vec3T<T>& a, const vec3T<T>& b) {
         // Treat the two points a and b as extrema for the bounding box, so we don't require a particular minimum/maximum coordinate order.
-        x = (a[0] <= b[0]) ? interval(a[0], b[0]) : interval(b[0], a[0]);
-        y = (a[1] <= b[1]) ? interval(a[1], b[1]) : interval(b[1], a[1]);
-        z = (a[2] <= b[2]) ? interval(a[2], b[2]) : interval(b[2], a[2]);
+        x = (a[0] <= b[0]) ? intervalT<T>(a[0], b[0]) : intervalT<T>(b[0], a[0]);
+        y = (a[1] <= b[1]) ? intervalT<T>(a[1], b[1]) : intervalT<T>(b[1], a[1]);
+        z = (a[2] <= b[2]) ? intervalT<T>(a[2], b[2]) : intervalT<T>(b[2], a[2]);
 
         padToMinimums();
     }
 
-    aabb(const aabb& box0, const aabb& box1) {
-        x = interval(box0.x, box1.x);
-        y = interval(box0.y, box1.y);
-        z = interval(box0.z, box1.z);
+    aabbT(const aabbT& box0, const aabbT& box1) {
+        x = intervalT<T>(box0.x, box1.x);
+        y = intervalT<T>(box0.y, box1.y);
+        z = intervalT<T>(box0.z, box1.z);
     }
 
-    const interval& axisInterval(int n) const {
+    const intervalT<T>& axisInterval(int n) const {
         if (n == 1) return y;
         if (n == 2) return z;
         return x;
     }
 
-    bool hit(const ray& r, interval rayT) const {
-        const point3& rayOrigin = r.origin();
-        const vec3& rayDirection  = r.direction();
+    bool hit(const rayT<T>& r, intervalT<T> rayT) const {
+        countStat(statBoxTests);
+        const vec3T<T>& rayOrigin = r.origin();
+        const vec3T<T>& rayDirection  = r.direction();
 
         for (int axis = 0; axis < 3; axis++) {
-            const interval& ax = axisInterval(axis);
-            const double adInv = 1.0 / rayDirection[axis];
+            const intervalT<T>& ax = axisInterval(axis);
+            const T adInv = 1.0 / rayDirection[axis];
 
             auto t0 = (ax.min - rayOrigin[axis]) * adInv;
             auto t1 = (ax.max - rayOrigin[axis]) * adInv;
@@ -67,27 +69,31 @@ class aabb {
         }
     }
 
-    static const aabb empty, universe;
+    static const aabbT empty, universe;
+
+    friend aabbT operator+(const aabbT& bBox, const vec3T<T>& offset) {
+        return aabbT(bBox.x + offset.x(), bBox.y + offset.y(), bBox.z + offset.z());
+    }
+
+    friend aabbT operator+(const vec3T<T>& offset, const aabbT& bBox) {
+        return bBox + offset;
+    }
 
     private: 
         void padToMinimums() {
             // Adjust the AABB so that no side is narrower than some delta, padding if necessary. 
-            double delta = 0.001;
+            T delta = T(0.001);
             if (x.size() < delta) x = x.expand(delta);
             if (y.size() < delta) y = y.expand(delta);
             if (z.size() < delta) z = z.expand(delta);
         }
 };
 
-const aabb aabb::empty = aabb(interval::empty, interval::empty, interval::empty);
-const aabb aabb::universe = aabb(interval::universe, interval::universe, interval::universe);
-
-aabb operator+(const aabb& bBox, const vec3& offset) {
-    return aabb(bBox.x + offset.x(), bBox.y + offset.y(), bBox.z + offset.z());
-}
+template <typename T>
+const aabbT<T> aabbT<T>::empty = aabbT<T>(intervalT<T>::empty, intervalT<T>::empty, intervalT<T>::empty);
+template <typename T>
+const aabbT<T> aabbT<T>::universe = aabbT<T>(intervalT<T>::universe, intervalT<T>::universe, intervalT<T>::universe);
 
-aabb operator+(const vec3& offset, const aabb& bBox) {
-    return bBox + offset;
-}
+using aabb = aabbT<real>;
 
-#endif
\ No newline at end of file
+#endif
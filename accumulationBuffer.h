@@ -0,0 +1,207 @@
+#ifndef ACCUMULATION_BUFFER_H
+#define ACCUMULATION_BUFFER_H
+
+#include "rayTracer.h"
+#include "framebuffer.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class renderJob {
+    // Which render a partial buffer belongs to, and which shard of it. Shards only merge when everything but the index
+    // matches, since buffers of different scenes or settings add up to an image that is none of them.
+  public:
+    int scene = 0;
+    std::string meshFile;       // --mesh, as given; scene 11 shows it.
+    int noiseGrid = 0;          // --bake-noise.
+    uint64_t seed = 0;
+    int rouletteDepth = 0;
+    int cropLeft = 0, cropTop = 0, cropWidth = 0, cropHeight = 0;   // The whole render's crop, as --crop gave it.
+    int firstSample = 0, sampleCount = 0;                           // The whole render's samples, before they were shared out.
+    bool splitSamples = false;
+    int shardIndex = 0, shardCount = 1;
+
+    bool sameRender(const renderJob& other) const {
+        return scene == other.scene && meshFile == other.meshFile && noiseGrid == other.noiseGrid && seed == other.seed && rouletteDepth == other.rouletteDepth && cropLeft == other.cropLeft
+            && cropTop == other.cropTop && cropWidth == other.cropWidth && cropHeight == other.cropHeight
+            && firstSample == other.firstSample && sampleCount == other.sampleCount && splitSamples == other.splitSamples
+            && shardCount == other.shardCount;
+    }
+
+    bool operator==(const renderJob& other) const {
+        return sameRender(other) && shardIndex == other.shardIndex;
+    }
+};
+
+class accumulationBuffer {
+    /*
+    * The raw sums of a render of one region of an image: each pixel's summed sample colour, in
+    * double precision, and how many samples went into it. Renders of different regions or
+    * different sample ranges of the same image add up to the render of the whole, since every
+    * sample's random numbers depend only on its pixel, its index and the camera's seed.
+    *
+    * On disk a buffer is a short text header followed by the sums (three doubles per pixel) and
+    * then the counts (one uint32 per pixel), both in scanline order and in the machine's byte
+    * order, like the PFM writer's floats:
+    *
+    *     RTACC
+    *     <image width> <image height>
+    *     <left> <top> <region width> <region height>
+    *     <first sample> <sample count> <seed>
+    *     <scene> <roulette depth> <crop x> <crop y> <crop width> <crop height> <render's first sample> <render's sample count>
+    *     <rows|samples> <shard> <shard count> <noise grid>
+    *     <mesh file, which may be empty or hold spaces>
+    */
+  public:
+    int imageWidth = 0, imageHeight = 0;
+    int left = 0, top = 0, width = 0, height = 0;   // The region the buffer covers.
+    int firstSample = 0, sampleCount = 0;           // Samples [firstSample, firstSample + sampleCount) of every pixel.
+    renderJob job;
+    std::vector<vec3d> sums;
+    std::vector<uint32_t> counts;
+
+    accumulationBuffer() {}
+
+    accumulationBuffer(int imageWidth, int imageHeight, int left, int top, int width, int height)
+      : imageWidth(imageWidth), imageHeight(imageHeight), left(left), top(top), width(width), height(height),
+        sums(size_t(width) * height), counts(size_t(width) * height, 0) {}
+
+    bool overlaps(const accumulationBuffer& other) const {
+        // Whether both buffers hold some of the same samples of some pixel, which merging would count twice.
+        return left < other.left + other.width && other.left < left + width && top < other.top + other.height
+            && other.top < top + height && firstSample < other.firstSample + other.sampleCount
+            && other.firstSample < firstSample + sampleCount;
+    }
+
+    bool add(const accumulationBuffer& other) {
+        // Add another buffer of the same image into this one's region. Returns false if the images differ.
+        if (other.imageWidth != imageWidth || other.imageHeight != imageHeight) return false;
+
+        for (int j = 0; j < other.height; j++) {
+            int y = other.top + j - top;
+            if (y < 0 || y >= height) continue;
+            for (int i = 0; i < other.width; i++) {
+                int x = other.left + i - left;
+                if (x < 0 || x >= width) continue;
+                auto source = size_t(j) * other.width + i;
+                auto target = size_t(y) * width + x;
+                sums[target] += other.sums[source];
+                counts[target] += other.counts[source];
+            }
+        }
+        return true;
+    }
+
+    framebuffer resolve() const {
+        // The mean of each pixel's samples, as an image of the whole frame. Pixels outside the region, or without samples, are black.
+        framebuffer image(imageWidth, imageHeight);
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                auto p = size_t(j) * width + i;
+                if (counts[p] > 0) image.setPixel(left + i, top + j, colour((1.0 / counts[p]) * sums[p]));
+            }
+        }
+        return image;
+    }
+
+    size_t missingPixels() const {
+        size_t missing = 0;
+        for (auto count : counts) missing += count == 0;
+        return missing;
+    }
+
+    bool write(const std::string& filename) const {
+        // Writes to filename + ".tmp" and renames it, so a buffer that exists on disk is always complete.
+        auto temporary = filename + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary);
+            if (!file) {
+                std::cerr << "ERROR: Could not open output file '" << temporary << "'.\n";
+                return false;
+            }
+
+            file << "RTACC\n" << imageWidth << ' ' << imageHeight << '\n' << left << ' ' << top << ' ' << width << ' ' << height
+                 << '\n' << firstSample << ' ' << sampleCount << ' ' << job.seed << '\n' << job.scene << ' ' << job.rouletteDepth
+                 << ' ' << job.cropLeft << ' ' << job.cropTop << ' ' << job.cropWidth << ' ' << job.cropHeight << ' '
+                 << job.firstSample << ' ' << job.sampleCount << '\n' << (job.splitSamples ? "samples" : "rows") << ' '
+                 << job.shardIndex << ' ' << job.shardCount << ' ' << job.noiseGrid << '\n' << job.meshFile << '\n';
+            // vec3d may be padded for SIMD, so the sums are written as plain doubles.
+            std::vector<double> components;
+            components.reserve(sums.size() * 3);
+            for (const auto& sum : sums) components.insert(components.end(), {sum.x(), sum.y(), sum.z()});
+            file.write(reinterpret_cast<const char*>(components.data()), std::streamsize(components.size() * sizeof(double)));
+            file.write(reinterpret_cast<const char*>(counts.data()), std::streamsize(counts.size() * sizeof(uint32_t)));
+            if (!file) {
+                std::cerr << "ERROR: Could not write '" << temporary << "'.\n";
+                return false;
+            }
+        }
+
+        std::remove(filename.c_str());
+        if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+            std::cerr << "ERROR: Could not rename '" << temporary << "' to '" << filename << "'.\n";
+            return false;
+        }
+        return true;
+    }
+
+    static const int maxImageSize = 1 << 16;    // Widest or tallest image a header may describe.
+
+    bool validHeader() const {
+        // Whether the header describes a region inside a plausible image, and a shard that exists.
+        return imageWidth > 0 && imageWidth <= maxImageSize && imageHeight > 0 && imageHeight <= maxImageSize
+            && left >= 0 && top >= 0 && width >= 0 && height >= 0 && left <= imageWidth - width && top <= imageHeight - height
+            && firstSample >= 0 && sampleCount >= 0 && job.shardCount >= 1 && job.shardIndex >= 0
+            && job.shardIndex < job.shardCount;
+    }
+
+    bool read(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        std::string magic;
+        if (!file || !(file >> magic) || magic != "RTACC") {
+            std::cerr << "ERROR: '" << filename << "' is not an accumulation buffer.\n";
+            return false;
+        }
+
+        std::string split;
+        file >> imageWidth >> imageHeight >> left >> top >> width >> height >> firstSample >> sampleCount >> job.seed;
+        file >> job.scene >> job.rouletteDepth >> job.cropLeft >> job.cropTop >> job.cropWidth >> job.cropHeight
+             >> job.firstSample >> job.sampleCount >> split >> job.shardIndex >> job.shardCount >> job.noiseGrid;
+        file.get();     // The newline that ends the shard line.
+        std::getline(file, job.meshFile);   // The last header line, ended by the newline before the data.
+        job.splitSamples = split == "samples";
+        if (!file || !validHeader() || (split != "rows" && split != "samples")) {
+            std::cerr << "ERROR: '" << filename << "' has a bad header.\n";
+            return false;
+        }
+
+        // Check the size before allocating, so a corrupt header cannot ask for more memory than the file holds.
+        auto pixelCount = size_t(width) * height;
+        auto dataStart = file.tellg();
+        file.seekg(0, std::ios::end);
+        auto dataBytes = uint64_t(file.tellg() - dataStart);
+        file.seekg(dataStart);
+        if (dataBytes < pixelCount * (3 * sizeof(double) + sizeof(uint32_t))) {
+            std::cerr << "ERROR: '" << filename << "' is truncated.\n";
+            return false;
+        }
+
+        std::vector<double> components(pixelCount * 3);
+        counts.resize(pixelCount);
+        file.read(reinterpret_cast<char*>(components.data()), std::streamsize(components.size() * sizeof(double)));
+        file.read(reinterpret_cast<char*>(counts.data()), std::streamsize(counts.size() * sizeof(uint32_t)));
+        if (!file) {
+            std::cerr << "ERROR: '" << filename << "' is truncated.\n";
+            return false;
+        }
+
+        sums.resize(pixelCount);
+        for (size_t p = 0; p < pixelCount; p++) sums[p] = vec3d(components[3 * p], components[3 * p + 1], components[3 * p + 2]);
+        return true;
+    }
+};
+
+#endif
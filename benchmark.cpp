@@ -0,0 +1,102 @@
+#include "rayTracer.h"
+#include "scenes.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+uint64_t peakResidentBytes(void) {
+    // Peak resident set size of the whole process so far. It never goes down, so a scene's figure includes every scene before it.
+    #ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+        return uint64_t(counters.PeakWorkingSetSize);
+    #else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+        #ifdef __APPLE__
+            return uint64_t(usage.ru_maxrss);           // Bytes on macOS.
+        #else
+            return uint64_t(usage.ru_maxrss) * 1024;    // Kilobytes on Linux.
+        #endif
+    #endif
+}
+
+int main(int argc, char* argv[]) {
+    // Usage: RaytracerBenchmark [--width N] [--spp N] [--seed N] [--threads N] [--scene N] [--wide-bvh 0|1] [--bake-noise N]
+    //
+    // Renders every scene (or just --scene N) at a fixed size, sample count and seed, and prints one JSON object with the cost
+    // of each. Images are not written.
+    int imageWidth = 200;
+    int samplesPerPixel = 16;
+    uint64_t seed = 0;
+    int threadCount = 0;
+    int onlyScene = 0;
+    bool wideBvh = false;
+    int noiseGrid = 0;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--width") == 0) imageWidth = std::atoi(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--spp") == 0) samplesPerPixel = std::atoi(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--seed") == 0) seed = std::strtoull(argv[i + 1], nullptr, 10);
+        else if (std::strcmp(argv[i], "--threads") == 0) threadCount = std::atoi(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--scene") == 0) onlyScene = std::atoi(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--wide-bvh") == 0) wideBvh = std::atoi(argv[i + 1]) != 0;
+        else if (std::strcmp(argv[i], "--bake-noise") == 0) noiseGrid = std::atoi(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option '" << argv[i] << "'.\n";
+            return 1;
+        }
+    }
+    if (argc % 2 == 0) {
+        // Options come in pairs, so the last one has no value.
+        std::cerr << "Option '" << argv[argc - 1] << "' needs a value.\n";
+        return 1;
+    }
+
+    std::cout << "{\n";
+    std::cout << "  \"width\": " << imageWidth << ",\n";
+    std::cout << "  \"samplesPerPixel\": " << samplesPerPixel << ",\n";
+    std::cout << "  \"seed\": " << seed << ",\n";
+    std::cout << "  \"threads\": " << threadPool(threadCount).size() << ",\n";
+    std::cout << "  \"wideBvh\": " << (wideBvh ? "true" : "false") << ",\n";
+    std::cout << "  \"noiseGrid\": " << noiseGrid << ",\n";
+    std::cout << "  \"scenes\": [";
+
+    bool first = true;
+    for (int sceneToShow = 1; sceneToShow <= sceneCount; sceneToShow++) {
+        if (onlyScene != 0 && sceneToShow != onlyScene) continue;
+
+        std::clog << "Scene " << sceneToShow << ": " << sceneName(sceneToShow) << '\n';
+
+        scene s;
+        s.wideBvh = wideBvh;
+        s.noiseGrid = noiseGrid;
+        s.cam.threadCount = threadCount;
+        sceneChooser(sceneToShow, s, seed);
+        s.cam.imageWidth = imageWidth;
+        s.cam.samplesPerPixel = samplesPerPixel;
+        s.cam.renderImage(s.world, s.lightSources());
+
+        const auto& stats = s.cam.statistics;
+        std::cout << (first ? "\n" : ",\n");
+        std::cout << "    {\"scene\": \"" << sceneName(sceneToShow) << "\""
+                  << ", \"seconds\": " << stats.seconds
+                  << ", \"rays\": " << stats.rays
+                  << ", \"samples\": " << stats.samples
+                  << ", \"raysPerSecond\": " << stats.rays / stats.seconds
+                  << ", \"samplesPerSecond\": " << stats.samples / stats.seconds
+                  << ", \"peakRssBytes\": " << peakResidentBytes() << "}";
+        first = false;
+    }
+
+    std::cout << "\n  ]\n}\n";
+}
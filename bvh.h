@@ -3,77 +3,478 @@
 
 #include "aabb.h"
 #include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdint>
 #include "hittable.h"
 #include "hittableList.h"
 #include "rayTracer.h"
+#include "threadPool.h"
+#include <chrono>
+#include <thread>
+#include <vector>
 
-class bvh_node : public hittable {
+class linearBvhNode {
+    /*
+    * One node of a flattened BVH, packed into 32 bytes so two nodes share a cache line.
+    *
+    * Nodes are stored depth first: an interior node's first child immediately follows it in the
+    * array and `offset` holds the index of its second child. A leaf stores the index of its first
+    * primitive in `offset` and its primitive count in `primitiveCount`.
+    */
   public:
-    bvh_node(hittableList list) : bvh_node(list.objects, 0, list.objects.size()) {
-        // This constructor (without span indices) creates an implicit copy of the hittable list, which we will modify. The lifetime of the copied list only extends until this constructor exits. 
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t offset;
+    uint16_t primitiveCount;    // Zero for interior nodes.
+    uint8_t axis;               // Split axis of an interior node.
+    uint8_t pad;
+
+    bool isLeaf() const {
+        return primitiveCount > 0;
     }
-    
-    bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
-        bBox = aabb::empty;
-        for (size_t objectIndex = start; objectIndex < end; objectIndex++) {
-            bBox = aabb(bBox, objects[objectIndex]->boundingBox());
+
+    void setBounds(const aabb& box) {
+        // Round outwards when narrowing to float, so the node never shrinks below the primitives it contains.
+        for (int axisIndex = 0; axisIndex < 3; axisIndex++) {
+            const interval& ax = box.axisInterval(axisIndex);
+            boundsMin[axisIndex] = roundDown(ax.min);
+            boundsMax[axisIndex] = roundUp(ax.max);
         }
+    }
 
-        int axis = bBox.longestAxis();
+    bool hit(const point3& origin, const vec3& invDirection, const int dirIsNeg[3], interval rayT) const {
+        // Slab test with the ray's precomputed inverse direction. dirIsNeg picks the near and far slab for each axis, so no swaps are needed.
+        for (int a = 0; a < 3; a++) {
+            double nearSlab = dirIsNeg[a] ? boundsMax[a] : boundsMin[a];
+            double farSlab = dirIsNeg[a] ? boundsMin[a] : boundsMax[a];
 
-        auto comparator = (axis == 0) ? boxXCompare
-                        : (axis == 1) ? boxYCompare
-                                      : boxZCompare;
+            auto t0 = (nearSlab - origin[a]) * invDirection[a];
+            auto t1 = (farSlab - origin[a]) * invDirection[a];
 
-        size_t object_span = end - start;
+            if (t0 > rayT.min) rayT.min = t0;
+            if (t1 < rayT.max) rayT.max = t1;
 
-        if (object_span == 1) {
-            left = right = objects[start];
-        } else if (object_span == 2) {
-            left = objects[start];
-            right = objects[start+1];
-        } else {
-            std::sort(objects.begin() + start, objects.begin() + end, comparator);
+            if (rayT.max <= rayT.min) return false;
+        }
+        return true;
+    }
+
+  private:
+    static float roundDown(double value) {
+        auto f = float(value);
+        return double(f) > value ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static float roundUp(double value) {
+        auto f = float(value);
+        return double(f) < value ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+};
+
+static_assert(sizeof(linearBvhNode) == 32, "linearBvhNode should fill exactly half a cache line.");
+
+template <typename leafFunction>
+bool traverseBvh(const std::vector<linearBvhNode>& nodes, const ray& r, interval& rayT, const leafFunction& testLeaf) {
+    // Walk a flattened BVH front to back. testLeaf(leaf, rayT) tests the leaf's primitives, shrinks rayT.max to the closest hit
+    // and returns whether it found one. Returns whether any leaf did.
+    if (nodes.empty()) return false;
+
+    const point3& origin = r.origin();
+    const vec3& direction = r.direction();
+    vec3 invDirection(1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z());
+    int dirIsNeg[3] = { invDirection.x() < 0, invDirection.y() < 0, invDirection.z() < 0 };
+
+    // Iterative traversal with an explicit stack of nodes still to visit.
+    uint32_t toVisit[64];
+    int toVisitCount = 0;
+    uint32_t current = 0;
+    bool hitAnything = false;
 
-            auto mid = start + object_span / 2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
+    while (true) {
+        const linearBvhNode& node = nodes[current];
+        countStat(statBvhNodeVisits);
+        countStat(statBoxTests);
+
+        if (node.hit(origin, invDirection, dirIsNeg, rayT)) {
+            if (node.isLeaf()) {
+                if (testLeaf(node, rayT)) hitAnything = true;
+                if (toVisitCount == 0) break;
+                current = toVisit[--toVisitCount];
+            } else if (dirIsNeg[node.axis]) {
+                // The ray travels towards -axis, so the second (upper) child is nearer. Visit it first.
+                toVisit[toVisitCount++] = current + 1;
+                current = node.offset;
+            } else {
+                toVisit[toVisitCount++] = node.offset;
+                current = current + 1;
+            }
+        } else {
+            if (toVisitCount == 0) break;
+            current = toVisit[--toVisitCount];
         }
     }
 
-    bool hit(const ray& r, interval ray_t, hitRecord& rec) const override {
-        if (!bBox.hit(r, ray_t)) return false;
+    return hitAnything;
+}
+
+class bvhBuildSettings {
+  public:
+    int maxPrimitivesInLeaf = 4;    // Largest leaf the builder may create.
+    int binCount = 12;              // Number of centroid bins evaluated per split.
+    double traversalCost = 1.0;     // SAH cost of visiting an interior node, relative to ...
+    double intersectionCost = 1.0;  // ... the cost of testing one primitive.
+    int threadCount = 0;            // Build threads, 0 uses RAYTRACER_THREADS or every hardware thread.
+};
+
+class bvhBuilder {
+    /*
+    * Builds a flattened BVH over a set of primitive bounding boxes.
+    *
+    * Each node is split with the surface area heuristic (SAH), evaluated over `binCount` equal
+    * centroid bins along the axis of largest centroid extent. A range becomes a leaf when it holds
+    * few enough primitives and no split is cheaper than testing them all.
+    *
+    * Large builds run in parallel: once a node is split, its second child's subtree is built on
+    * its own thread into a separate node array and spliced in afterwards. Only the top few levels
+    * fork, so at most about twice as many subtrees as threads are in flight.
+    *
+    * The builder only sees bounds, so any primitive container can use it. After build(),
+    * `nodes` holds the flattened tree and `primitiveOrder` maps each leaf slot to the index of the
+    * primitive that belongs there; callers reorder their primitives to match.
+    */
+  public:
+    std::vector<linearBvhNode> nodes;
+    std::vector<uint32_t> primitiveOrder;
+    double sahCost = 0;     // Expected cost of a ray through the root, in units of intersectionCost.
+    double buildSeconds = 0;
+
+    bvhBuilder(const bvhBuildSettings& settings = bvhBuildSettings()) : settings(settings) {}
+
+    void build(const std::vector<aabb>& primitiveBounds) {
+        auto startTime = std::chrono::steady_clock::now();
+
+        nodes.clear();
+        sahCost = 0;
+        primitiveOrder.resize(primitiveBounds.size());
+        for (size_t i = 0; i < primitiveOrder.size(); i++) primitiveOrder[i] = uint32_t(i);
+
+        if (primitiveBounds.empty()) return;
+
+        threadPool pool(settings.threadCount);
+        // Fork while fewer than twice as many subtrees as threads are in flight: at depths below ceil(log2(2 threads)).
+        forkDepth = 0;
+        while ((1 << forkDepth) < 2 * pool.size()) forkDepth++;
 
-        bool hitLeft = left->hit(r, ray_t, rec);
-        bool hitRight = right->hit(r, interval(ray_t.min, hitLeft ? rec.t : ray_t.max), rec);
+        // Compute every centroid once, rather than re-deriving it at each level of the tree.
+        bounds = &primitiveBounds;
+        centroids.resize(primitiveBounds.size());
+        parallelChunks(pool, primitiveBounds.size(), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    const interval& ax = primitiveBounds[i].axisInterval(axis);
+                    centroids[i][axis] = 0.5 * (ax.min + ax.max);
+                }
+            }
+        });
 
-        return hitLeft || hitRight;
+        aabb rootBox = aabb::empty;
+        for (const auto& box : primitiveBounds) rootBox = aabb(rootBox, box);
+        rootArea = surfaceArea(rootBox) > 0 ? surfaceArea(rootBox) : 1;
+
+        subtree root;
+        root.nodes.reserve(2 * primitiveBounds.size());
+        buildRecursive(0, primitiveBounds.size(), 0, root);
+        nodes = std::move(root.nodes);
+        sahCost = root.cost;
+
+        bounds = nullptr;
+        centroids.clear();
+        centroids.shrink_to_fit();
+
+        buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
     }
 
-    aabb boundingBox() const override { return bBox; }
+    template <typename chunkFunction>
+    static void parallelChunks(threadPool& pool, size_t count, const chunkFunction& work) {
+        // Run work(first, last) over [0, count) in one contiguous chunk per thread.
+        int chunks = count < 4096 ? 1 : pool.size();
+        pool.parallelFor(chunks, [&](int chunk) {
+            work(count * chunk / chunks, count * (chunk + 1) / chunks);
+        });
+    }
+
+    static double surfaceArea(const aabb& box) {
+        auto dx = box.x.size(), dy = box.y.size(), dz = box.z.size();
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
 
   private:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
-    aabb bBox;
+    // Past this depth ranges are split at the median, which bounds the tree depth (and the traversal stack) at 64.
+    static const int maxSahDepth = 32;
+
+    // Ranges smaller than this are never handed to another thread.
+    static const size_t minParallelSpan = 4096;
+
+    bvhBuildSettings settings;
+    int forkDepth = 0;      // Nodes shallower than this hand their second child to another thread.
+    const std::vector<aabb>* bounds = nullptr;
+    std::vector<point3> centroids;
+    double rootArea = 0;
+
+    struct bin {
+        aabb bBox = aabb::empty;
+        size_t count = 0;
+    };
+
+    struct subtree {
+        std::vector<linearBvhNode> nodes;
+        double cost = 0;
+    };
+
+    uint32_t buildRecursive(size_t start, size_t end, int depth, subtree& out) {
+        auto nodeIndex = uint32_t(out.nodes.size());
+        out.nodes.emplace_back();
+
+        // Centroid bounds are kept as bare intervals, since the aabb constructor would pad them.
+        aabb bBox = aabb::empty;
+        interval centroidBounds[3];
+        for (size_t i = start; i < end; i++) {
+            bBox = aabb(bBox, (*bounds)[primitiveOrder[i]]);
+            const point3& c = centroids[primitiveOrder[i]];
+            for (int a = 0; a < 3; a++) centroidBounds[a] = interval(centroidBounds[a], interval(c[a], c[a]));
+        }
+        out.nodes[nodeIndex].setBounds(bBox);
+
+        auto area = surfaceArea(bBox);
+        auto relativeArea = area / rootArea;
+
+        size_t objectSpan = end - start;
+        auto leafCost = settings.intersectionCost * objectSpan;
+        bool fitsInLeaf = objectSpan <= size_t(std::max(settings.maxPrimitivesInLeaf, 1));
+
+        int axis = longestAxis(centroidBounds);
+        const interval& centroidRange = centroidBounds[axis];
+        size_t mid = start;
 
-    static bool boxCompare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axisIndex) {
-        auto aAxisInterval = a->boundingBox().axisInterval(axisIndex);
-        auto bAxisInterval = b->boundingBox().axisInterval(axisIndex);
-        return aAxisInterval.min < bAxisInterval.min;
+        if (objectSpan == 1 || (fitsInLeaf && centroidRange.size() <= 0)) {
+            return makeLeaf(out, nodeIndex, start, objectSpan, leafCost * relativeArea);
+        }
+
+        if (centroidRange.size() <= 0 || depth >= maxSahDepth) {
+            mid = medianSplit(start, end, axis);
+        } else {
+            // Bin the primitives by centroid and evaluate the SAH at every bin boundary.
+            int binCount = std::max(settings.binCount, 2);
+            std::vector<bin> bins(binCount);
+            auto binScale = binCount / centroidRange.size();
+            auto binIndex = [&](uint32_t primitive) {
+                int b = int((centroids[primitive][axis] - centroidRange.min) * binScale);
+                return b < binCount ? b : binCount - 1;
+            };
+
+            for (size_t i = start; i < end; i++) {
+                auto& target = bins[binIndex(primitiveOrder[i])];
+                target.count++;
+                target.bBox = aabb(target.bBox, (*bounds)[primitiveOrder[i]]);
+            }
+
+            // Sweep from the right to collect the area and count above each boundary, then from the left to price each split.
+            std::vector<double> rightArea(binCount);
+            std::vector<size_t> rightCount(binCount);
+            aabb rightBox = aabb::empty;
+            size_t count = 0;
+            for (int b = binCount - 1; b > 0; b--) {
+                rightBox = aabb(rightBox, bins[b].bBox);
+                count += bins[b].count;
+                rightArea[b] = count > 0 ? surfaceArea(rightBox) : 0;
+                rightCount[b] = count;
+            }
+
+            int bestSplit = -1;
+            auto bestCost = infinity;
+            aabb leftBox = aabb::empty;
+            count = 0;
+            for (int b = 1; b < binCount; b++) {
+                leftBox = aabb(leftBox, bins[b - 1].bBox);
+                count += bins[b - 1].count;
+                if (count == 0 || rightCount[b] == 0) continue;
+
+                auto cost = settings.traversalCost
+                          + settings.intersectionCost * (count * surfaceArea(leftBox) + rightCount[b] * rightArea[b]) / area;
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestSplit = b;
+                }
+            }
+
+            if (fitsInLeaf && leafCost <= bestCost) {
+                return makeLeaf(out, nodeIndex, start, objectSpan, leafCost * relativeArea);
+            }
+
+            if (bestSplit < 0) {
+                mid = medianSplit(start, end, axis);
+            } else {
+                auto split = std::partition(primitiveOrder.begin() + start, primitiveOrder.begin() + end,
+                    [&](uint32_t primitive) { return binIndex(primitive) < bestSplit; });
+                mid = size_t(split - primitiveOrder.begin());
+            }
+        }
+
+        out.cost += settings.traversalCost * relativeArea;
+
+        uint32_t secondChild;
+        if (objectSpan >= minParallelSpan && depth < forkDepth) {
+            // Build the second child on another thread into its own array, then splice it in after the first child.
+            subtree right;
+            std::thread worker([&] { buildRecursive(mid, end, depth + 1, right); });
+            buildRecursive(start, mid, depth + 1, out);
+            worker.join();
+
+            secondChild = uint32_t(out.nodes.size());
+            for (auto& node : right.nodes) {
+                if (!node.isLeaf()) node.offset += secondChild;
+            }
+            out.nodes.insert(out.nodes.end(), right.nodes.begin(), right.nodes.end());
+            out.cost += right.cost;
+        } else {
+            buildRecursive(start, mid, depth + 1, out);
+            secondChild = buildRecursive(mid, end, depth + 1, out);
+        }
+
+        out.nodes[nodeIndex].offset = secondChild;
+        out.nodes[nodeIndex].primitiveCount = 0;
+        out.nodes[nodeIndex].axis = uint8_t(axis);
+        return nodeIndex;
     }
 
-    static bool boxXCompare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return boxCompare(a, b, 0);
+    static uint32_t makeLeaf(subtree& out, uint32_t nodeIndex, size_t start, size_t count, double cost) {
+        out.nodes[nodeIndex].offset = uint32_t(start);
+        out.nodes[nodeIndex].primitiveCount = uint16_t(count);
+        out.nodes[nodeIndex].axis = 0;
+        out.cost += cost;
+        return nodeIndex;
     }
 
-    static bool boxYCompare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return boxCompare(a, b, 1);
+    size_t medianSplit(size_t start, size_t end, int axis) {
+        auto mid = start + (end - start) / 2;
+        std::nth_element(primitiveOrder.begin() + start, primitiveOrder.begin() + mid, primitiveOrder.begin() + end,
+            [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+        return mid;
     }
 
-    static bool boxZCompare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return boxCompare(a, b, 2);
+    static int longestAxis(const interval extents[3]) {
+        auto dx = extents[0].size(), dy = extents[1].size(), dz = extents[2].size();
+        if (dx > dy) return dx > dz ? 0 : 2;
+        return dy > dz ? 1 : 2;
     }
 };
 
-#endif
\ No newline at end of file
+class bvh_node : public hittable {
+  public:
+    bvh_node(const hittableList& list, const bvhBuildSettings& settings = bvhBuildSettings()) {
+        std::vector<aabb> primitiveBounds(list.objects.size());
+        threadPool pool(settings.threadCount);
+        bvhBuilder::parallelChunks(pool, primitiveBounds.size(), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) primitiveBounds[i] = list.objects[i]->boundingBox();
+        });
+
+        bvhBuilder builder(settings);
+        builder.build(primitiveBounds);
+        nodes = std::move(builder.nodes);
+        sahCost = builder.sahCost;
+
+        std::clog << "BVH: " << primitiveBounds.size() << " primitives, " << nodes.size() << " nodes, SAH cost " << sahCost
+                  << ", built in " << 1000 * builder.buildSeconds << " ms on " << pool.size() << " threads.\n";
+
+        // Store the primitives in leaf order, so each leaf's primitives are contiguous in memory.
+        primitives.reserve(list.objects.size());
+        for (auto index : builder.primitiveOrder) {
+            primitives.push_back(list.objects[index]);
+        }
+
+        bBox = aabb::empty;
+        for (const auto& box : primitiveBounds) {
+            bBox = aabb(bBox, box);
+        }
+    }
+
+    bool intersect(const ray& r, interval ray_t, hitRecord& rec) const override {
+        return traverseBvh(nodes, r, ray_t, [&](const linearBvhNode& leaf, interval& rayT) {
+            bool hitAnything = false;
+            for (uint32_t i = 0; i < leaf.primitiveCount; i++) {
+                if (primitives[leaf.offset + i]->intersect(r, rayT, rec)) {
+                    hitAnything = true;
+                    rayT.max = rec.t;
+                }
+            }
+            return hitAnything;
+        });
+    }
+
+    void intersectPacket(rayPacket& packet, hitRecord recs[]) const override {
+        // Trace the whole packet down the tree. Each stack entry carries the mask of lanes that hit its parent, and a node is
+        // only visited while at least one of those lanes hits its box. Children are ordered by the first live lane's direction.
+        if (nodes.empty()) return;
+
+        struct stackEntry {
+            uint32_t node;
+            int mask;
+        };
+        stackEntry toVisit[128];
+        int toVisitCount = 0;
+        toVisit[toVisitCount++] = { 0, packet.activeMask() };
+
+        while (toVisitCount > 0) {
+            auto entry = toVisit[--toVisitCount];
+            const linearBvhNode& node = nodes[entry.node];
+            countStat(statBvhNodeVisits);
+            countStat(statBoxTests, std::bitset<rayPacket::size>(entry.mask).count());
+
+            int mask = packet.hitBox(node.boundsMin, node.boundsMax, entry.mask);
+            if (mask == 0) continue;
+
+            if (node.isLeaf()) {
+                for (int k = 0; k < packet.count; k++) {
+                    if (!(mask & (1 << k))) continue;
+
+                    threadRandomState() = packet.random[k];
+                    for (uint32_t i = 0; i < node.primitiveCount; i++) {
+                        if (primitives[node.offset + i]->intersect(packet.rays[k], interval(packet.tMin, packet.tMax[k]), recs[k])) {
+                            packet.recordHit(k, recs[k].t);
+                        }
+                    }
+                    packet.random[k] = threadRandomState();
+                }
+                continue;
+            }
+
+            int lane = 0;
+            while (!(mask & (1 << lane))) lane++;
+            const float laneInvDirection[3] = { packet.invDirX[lane], packet.invDirY[lane], packet.invDirZ[lane] };
+
+            if (laneInvDirection[node.axis] < 0) {
+                toVisit[toVisitCount++] = { entry.node + 1, mask };
+                toVisit[toVisitCount++] = { node.offset, mask };
+            } else {
+                toVisit[toVisitCount++] = { node.offset, mask };
+                toVisit[toVisitCount++] = { entry.node + 1, mask };
+            }
+        }
+    }
+
+    aabb boundingBox() const override { return bBox; }
+
+    double cost() const {
+        // The SAH cost of the tree: the expected number of node visits and primitive tests for a random ray through the root.
+        return sahCost;
+    }
+
+  private:
+    std::vector<linearBvhNode> nodes;
+    double sahCost = 0;
+    std::vector<shared_ptr<hittable>> primitives;
+    aabb bBox;
+};
+
+#endif
@@ -2,16 +2,103 @@
 #define CAMERA_H
 
 #include "rayTracer.h"
+#include "accumulationBuffer.h"
+#include "denoiser.h"
+#include "framebuffer.h"
 #include "hittable.h"
+#include "imageWriter.h"
+#include "integrator.h"
 #include "material.h"
+#include "threadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class renderStatistics {
+    // What the last render cost.
+  public:
+    double seconds = 0;     // Wall time of the render, excluding writing the image.
+    uint64_t samples = 0;   // Camera samples taken.
+    uint64_t rays = 0;      // Rays traced: camera rays plus every bounce.
+    tracingStats tracing;   // BVH and primitive work, counted only in RAYTRACER_STATS builds.
+};
+
+class pixelEstimate {
+    // Running sums of one pixel's samples: enough for the pixel's mean colour and the variance of its luminance.
+  public:
+    vec3d sum;         // Sum of the sample colours, in double precision whatever real is.
+    double luminanceSum = 0;
+    double luminanceSquaredSum = 0;
+    double brightnessSum = 0;           // Sums of the unclamped luminance, for the denoiser, which must see fireflies as noise.
+    double brightnessSquaredSum = 0;
+    int samples = 0;
+    double cost = 0;    // Traversal cost of the samples (see tracingStats), counted only in RAYTRACER_STATS builds.
+    vec3d albedoSum;    // Sums of the samples' surfaceFeatures, when the camera collects them.
+    vec3d normalSum;
+    double depthSum = 0;
+    const hittable* firstObject = nullptr;  // The first sample's object and material; ids do not average.
+    materialHandle firstMaterial = 0;
+
+    void add(const colour& sample) {
+        // Luminance is clamped to what the display can show, so overexposed pixels do not look noisy.
+        auto brightness = 0.2126 * sample.x() + 0.7152 * sample.y() + 0.0722 * sample.z();
+        auto luminance = std::fmin(1.0, brightness);
+        sum += vec3d(sample);
+        luminanceSum += luminance;
+        luminanceSquaredSum += luminance * luminance;
+        brightnessSum += brightness;
+        brightnessSquaredSum += brightness * brightness;
+        samples++;
+    }
+
+    void addFeatures(const surfaceFeatures& features) {
+        // Called after add(), with the same sample's features.
+        if (samples == 1) {
+            firstObject = features.object;
+            firstMaterial = features.mat;
+        }
+        albedoSum += vec3d(features.albedo);
+        normalSum += vec3d(features.normal);
+        depthSum += features.depth;
+    }
+
+    colour mean() const {
+        return samples > 0 ? colour((1.0 / samples) * sum) : colour(0, 0, 0);
+    }
+
+    double error() const {
+        // Standard error of the mean luminance after gamma correction (sqrt(L) changes by dL / (2 sqrt(L))), so the same
+        // threshold means the same visible noise in dark and bright pixels.
+        if (samples < 2) return infinity;
+        auto mean = luminanceSum / samples;
+        auto variance = std::fmax(0.0, (luminanceSquaredSum - samples * mean * mean) / (samples - 1));
+        auto standardError = std::sqrt(variance / samples);
+        return standardError / (2 * std::sqrt(std::fmax(mean, 1e-8)));
+    }
+
+    double brightnessVariance() const {
+        // Variance of the mean unclamped luminance. A single sample is taken to be as uncertain as it is bright.
+        if (samples < 1) return 0;
+        auto mean = brightnessSum / samples;
+        if (samples < 2) return mean * mean;
+        auto variance = std::fmax(0.0, (brightnessSquaredSum - samples * mean * mean) / (samples - 1));
+        return variance / samples;
+    }
+};
 
 class camera {
     public: 
         double aspectRatio = 1.0;   // Ratio of image width over height
         int imageWidth  = 100;      // Rendered image width in pixel count
-        int samplesPerPixel = 10;   // Count of random samples for each pixel. 
+        int samplesPerPixel = 10;   // Count of random samples for each pixel. With adaptive sampling, the average over the image.
         int maxDepth = 10;          // Maximum number of ray bounces into the scene.
+        int rouletteDepth = 3;      // Bounces every path gets before Russian roulette may end it; maxDepth or more turns it off.
         colour background;          // Scene background colour. 
+        const materialRegistry* materials = nullptr;    // Registry of the world's materials; null for sceneMaterials().
 
         double vFieldOfView = 90;           // Vertical view angle (field of view)
         point3 lookFrom = point3(0, 0, 0);  // Point camera is looking from.  
@@ -21,30 +108,196 @@ class camera {
         double defocusAngle = 0;    // Variation angle of rays through each pixel.
         double focusDistance = 10;  // Distance from camera lookFrom point to plane of perfect focus.
 
-        void render(const hittable& world) {
+        int threadCount = 0;        // Render threads, 0 uses RAYTRACER_THREADS or every hardware thread.
+        int tileSize = 16;          // Width and height of the square pixel tiles handed to the render threads.
+        bool packetTracing = true;  // Trace camera rays in packets of neighbouring pixels; bounces are traced as single rays.
+        bool lightSampling = true;  // Sample the lights passed to render() directly at diffuse surfaces and in media.
+
+        bool adaptiveSampling = false;  // Stop sampling pixels that have converged and spend their samples on noisy ones.
+        int minSamples = 16;            // Adaptive: samples every pixel gets before its noise is measured.
+        int maxSamples = 0;             // Adaptive: most samples any one pixel may get, 0 for 8 x samplesPerPixel.
+        double adaptiveThreshold = 0.01;    // Adaptive: a pixel has converged when its displayed brightness has this standard error.
+
+        shared_ptr<integrator> renderIntegrator = make_shared<pathIntegrator>();  // Computes the light arriving along each camera ray.
+
+        std::string outputFile;     // Image file to write; .png, .pfm or .ppm. Empty writes a binary PPM to standard output.
+        uint64_t seed = 0;          // Selects the random sequences of every sample, so different seeds give independent images.
+
+        std::string heatmapFile;    // RAYTRACER_STATS builds: also write each pixel's traversal cost per sample to this image.
+
+        std::string denoisedFile;   // Also write a denoised copy of the image to this file; outputFile keeps the raw image.
+        denoiser denoising;         // Settings of the denoiser behind denoisedFile and denoise().
+        featureBuffers features;    // The first-hit albedo, normal and depth of the last render, if it needed them.
+
+        // Also write the AOVs of the render as float images named by this prefix: "out_" gives out_depth.pfm, out_normal.pfm,
+        // out_albedo.pfm, out_objectId.pfm, out_materialId.pfm, out_samples.pfm and out_variance.pfm (see featureBuffers).
+        std::string aovPrefix;
+
+        // Distributed rendering: a render can cover one region of the image and one range of each pixel's samples, and save
+        // the raw sums for merging with other renders of the same image (see accumulationBuffer).
+        int cropLeft = 0, cropTop = 0;      // Top-left pixel of the region to render.
+        int cropWidth = 0, cropHeight = 0;  // Size of the region, 0 to reach the image's right or bottom edge.
+        int firstSample = 0;                // Render samples [firstSample, firstSample + samplesPerPixel) of each pixel.
+        std::string partialFile;            // Write the region's sample sums and counts here, instead of any image.
+        accumulationBuffer accumulation;    // The region's sums from the last render, kept when partialFile is set.
+        renderJob job;                      // Which render and shard partialFile holds; selectShard() fills in all but the scene.
+
+        renderStatistics statistics;    // Filled in by every render.
+
+        void selectShard(int index, int count, bool bySamples) {
+            // Narrow the render to shard index of count: a band of the crop region's rows, or a part of every pixel's sample
+            // range. The shards cover the region and the range exactly once, so their partial buffers add up to the whole.
+            job.seed = seed;
+            job.rouletteDepth = rouletteDepth;
+            job.cropLeft = cropLeft;
+            job.cropTop = cropTop;
+            job.cropWidth = cropWidth;
+            job.cropHeight = cropHeight;
+            job.firstSample = firstSample;
+            job.sampleCount = samplesPerPixel;
+            job.splitSamples = bySamples;
+            job.shardIndex = index;
+            job.shardCount = count;
+
+            if (bySamples) {
+                firstSample += int(int64_t(index) * samplesPerPixel / count);
+                samplesPerPixel = int(int64_t(index + 1) * samplesPerPixel / count) - int(int64_t(index) * samplesPerPixel / count);
+            } else {
+                int fullHeight = std::max(1, int(imageWidth / aspectRatio));
+                int top = std::min(std::max(cropTop, 0), fullHeight);
+                int height = cropHeight > 0 ? std::min(cropHeight, fullHeight - top) : fullHeight - top;
+                cropTop = top + int(int64_t(index) * height / count);
+                cropHeight = top + int(int64_t(index + 1) * height / count) - cropTop;
+                if (cropHeight == 0) cropTop = fullHeight;  // More shards than rows: this one has nothing to render.
+            }
+        }
+
+        void render(const hittable& world, const hittable* lights = nullptr) {
+            auto image = renderImage(world, lights);
+            if (!partialFile.empty()) {
+                accumulation.write(partialFile);
+                return;
+            }
+
+            writeImage(image, outputFile);
+            if (!denoisedFile.empty()) writeImage(denoise(image), denoisedFile);
+            if (!aovPrefix.empty()) writeAovs(aovPrefix);
+        }
+
+        void writeAovs(const std::string& prefix) const {
+            // Write the last render's AOVs, one float image each; scalars are written to all three channels.
+            if (features.empty()) {
+                std::cerr << "ERROR: The last render collected no AOVs.\n";
+                return;
+            }
+
+            auto scalarImage = [this](auto value) {
+                framebuffer image(imageWidth, imageHeight);
+                for (int j = 0; j < imageHeight; j++) {
+                    for (int i = 0; i < imageWidth; i++) {
+                        auto v = real(value(size_t(j) * imageWidth + i));
+                        image.setPixel(i, j, colour(v, v, v));
+                    }
+                }
+                return image;
+            };
+
+            writeImage(scalarImage([this](size_t p) { return features.depth[p]; }), prefix + "depth.pfm");
+            writeImage(features.normal, prefix + "normal.pfm");
+            writeImage(features.albedo, prefix + "albedo.pfm");
+            writeImage(scalarImage([this](size_t p) { return features.objectId[p]; }), prefix + "objectId.pfm");
+            writeImage(scalarImage([this](size_t p) { return features.materialId[p]; }), prefix + "materialId.pfm");
+            writeImage(scalarImage([this](size_t p) { return features.samples[p]; }), prefix + "samples.pfm");
+            writeImage(scalarImage([this](size_t p) { return features.variance[p]; }), prefix + "variance.pfm");
+        }
+
+        framebuffer denoise(const framebuffer& image) {
+            // Denoise an image of the last render, guided by its features. Renders collect features when denoisedFile is set.
+            if (features.empty()) {
+                std::cerr << "ERROR: The last render collected no features to denoise by.\n";
+                return image;
+            }
+
+            auto startTime = std::chrono::steady_clock::now();
+            threadPool pool(threadCount);
+            auto denoised = denoising.denoise(image, features, pool);
+            std::clog << "Denoised in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() << " s.\n";
+            return denoised;
+        }
+
+        framebuffer renderImage(const hittable& world, const hittable* lights = nullptr) {
+            // Render the world and return the image without writing it anywhere. lights, if given, are emitters of the world
+            // (quads and spheres) to aim rays at.
+            auto startTime = std::chrono::steady_clock::now();
+
             initialise();
+            context.world = &world;
+            context.lights = lightSampling ? lights : nullptr;
+            context.materials = materials ? materials : &sceneMaterials();
+            context.background = background;
+            context.maxDepth = maxDepth;
+            context.rouletteDepth = rouletteDepth;
+            context.pixelSpread = pixelDeltaV.length() / focusDistance;
+
+            auto pixelCount = size_t(imageWidth) * imageHeight;
+            collectingFeatures = !denoisedFile.empty() || !aovPrefix.empty();
+            estimates.assign(pixelCount, pixelEstimate());
+            sampleTargets.assign(pixelCount, 0);
 
-            std::cout << "P3\n" << imageWidth << ' ' << imageHeight << "\n255\n";
+            regionLeft = std::min(std::max(cropLeft, 0), imageWidth);
+            regionTop = std::min(std::max(cropTop, 0), imageHeight);
+            regionRight = cropWidth > 0 ? std::min(regionLeft + cropWidth, imageWidth) : imageWidth;
+            regionBottom = cropHeight > 0 ? std::min(regionTop + cropHeight, imageHeight) : imageHeight;
+            bool partial = regionLeft > 0 || regionTop > 0 || regionRight < imageWidth || regionBottom < imageHeight
+                        || firstSample > 0 || !partialFile.empty();
+            if (adaptiveSampling && partial) {
+                std::cerr << "ERROR: Adaptive sampling cannot be split into regions or sample ranges; sampling every pixel evenly.\n";
+            }
+
+            threadPool pool(threadCount);
+            int tilesX = (regionRight - regionLeft + tileSize - 1) / tileSize;
+            int tilesY = (regionBottom - regionTop + tileSize - 1) / tileSize;
+            std::clog << "Rendering " << tilesX * tilesY << " tiles on " << pool.size() << " threads.\n";
+
+            statistics = renderStatistics();
+            if (!adaptiveSampling || partial) {
+                for (int j = regionTop; j < regionBottom; j++) {
+                    std::fill_n(sampleTargets.begin() + size_t(j) * imageWidth + regionLeft, regionRight - regionLeft, samplesPerPixel);
+                }
+                renderPass(pool);
+            } else {
+                renderAdaptive(pool);
+            }
 
+            framebuffer image(imageWidth, imageHeight);
+            uint64_t samplesTaken = 0;
             for (int j = 0; j < imageHeight; j++) {
-                std::clog << "\rScanlines remaining: " << (imageHeight - j) << ' ' << std::flush;
-                
                 for (int i = 0; i < imageWidth; i++) {
-                    colour pixelColour(0, 0, 0);
-                    for (int sample = 0; sample < samplesPerPixel; sample++) {
-                        ray r = getRay(i, j);
-                        pixelColour += rayColour(r, maxDepth, world);
-                    }
-                    writeColour(std::cout, pixelSamplesScale * pixelColour);
+                    const auto& estimate = estimates[size_t(j) * imageWidth + i];
+                    image.setPixel(i, j, estimate.mean());
+                    samplesTaken += estimate.samples;
                 }
             }
 
-            std::clog << "\rDone.                 \n";
+            statistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+            statistics.samples = samplesTaken;
+
+            std::clog << "\rDone in " << statistics.seconds << " s, " << statistics.rays / statistics.seconds / 1e6 << " Mrays/s";
+            if (adaptiveSampling && !partial) std::clog << ", " << double(samplesTaken) / pixelCount << " samples per pixel on average";
+            std::clog << ".\n";
+
+            if (statsEnabled) statistics.tracing.print(std::clog);
+            if (!heatmapFile.empty()) writeHeatmap();
+            features = collectingFeatures ? gatherFeatures() : featureBuffers();
+            accumulation = !partialFile.empty() ? gatherAccumulation() : accumulationBuffer();
+
+            estimates.clear();
+            sampleTargets.clear();
+            return image;
         }
 
     private: 
         int    imageHeight;         // Rendered image height
-        double  pixelSamplesScale;  // Colour scale factor for a sum of pixel samples.
         point3  centre;             // Camera center
         point3  pixel00Location;    // Location of pixel 0, 0
         vec3    pixelDeltaU;        // Offset to pixel to the right
@@ -52,13 +305,17 @@ class camera {
         vec3    u, v, w;            // Camera frame basis vectors. 
         vec3    defocusDiskU;       // Defocus disk horizontal radius. 
         vec3    defocusDiskV;       // Defocus disk vertical radius. 
+        renderContext context;      // What the integrator needs to know about the scene and camera.
+        bool collectingFeatures;    // Whether this render keeps each sample's surfaceFeatures.
+        int regionLeft, regionTop, regionRight, regionBottom;   // The pixels [left, right) x [top, bottom) this render covers.
+
+        std::vector<pixelEstimate> estimates;   // Each pixel's samples so far, in scanline order.
+        std::vector<int> sampleTargets;         // Sample count each pixel should reach by the end of the current pass.
 
         void initialise() {
             imageHeight = int(imageWidth / aspectRatio);
             imageHeight = (imageHeight < 1) ? 1 : imageHeight;
 
-            pixelSamplesScale = 1.0 / samplesPerPixel;
-
             centre = lookFrom;
 
             // Determine viewport dimensions.
@@ -90,6 +347,329 @@ class camera {
             defocusDiskV = v * defocusRadius;
         }
 
+        // Camera rays use the first random dimensions of each sample, and the path continues from this dimension onwards. Fixing
+        // the split keeps packet and single-ray rendering on the same random numbers.
+        static const uint64_t cameraDimensions = 1 << 16;
+
+        // Pixel block traced as one packet: packetWidth x packetHeight neighbouring pixels, one lane each.
+        static const int packetWidth = 4;
+        static const int packetHeight = rayPacket::size / packetWidth;
+
+        void renderPass(threadPool& pool) {
+            // Bring every pixel of the region up to its sample target, one tile per task, adding the rays traced to the statistics.
+            int tilesX = (regionRight - regionLeft + tileSize - 1) / tileSize;
+            int tilesY = (regionBottom - regionTop + tileSize - 1) / tileSize;
+            int tileCount = tilesX * tilesY;
+            int tilesRemaining = tileCount;
+            std::mutex progressLock;
+
+            pool.parallelFor(tileCount, [&](int tileIndex) {
+                int x0 = regionLeft + (tileIndex % tilesX) * tileSize;
+                int y0 = regionTop + (tileIndex / tilesX) * tileSize;
+                auto raysBefore = threadRayCount();
+                auto statsBefore = threadStats();
+                renderTile(x0, y0);
+                auto tileRays = threadRayCount() - raysBefore;
+
+                std::lock_guard<std::mutex> guard(progressLock);
+                statistics.rays += tileRays;
+                if (statsEnabled) statistics.tracing += threadStats() - statsBefore;
+                std::clog << "\rTiles remaining: " << --tilesRemaining << ' ' << std::flush;
+            });
+        }
+
+        void renderAdaptive(threadPool& pool) {
+            /*
+            * Adaptive sampling, in rounds. Every pixel first gets minSamples samples. Noise is then judged
+            * per block of packetWidth x packetHeight pixels, by the block's noisiest pixel: a single pixel
+            * whose few samples all happened to miss the light looks converged, its neighbours do not.
+            * After each round the blocks still above the threshold get as many samples again (up to
+            * maxSamples), noisiest first, until they converge or the image has used its budget of
+            * samplesPerPixel x pixels. A block's pixels always have the same sample count, so packets
+            * stay full. Each round is a full pass over the tiles, so the rounds, and the image, do not
+            * depend on the number of threads.
+            */
+            auto pixelCount = estimates.size();
+            auto budget = uint64_t(samplesPerPixel) * pixelCount;
+            int firstSamples = std::max(1, std::min(minSamples, samplesPerPixel));
+            int pixelLimit = maxSamples > 0 ? maxSamples : 8 * samplesPerPixel;
+
+            std::fill(sampleTargets.begin(), sampleTargets.end(), firstSamples);
+            renderPass(pool);
+            uint64_t samplesTaken = uint64_t(firstSamples) * pixelCount;
+
+            int blocksX = (imageWidth + packetWidth - 1) / packetWidth;
+            int blocksY = (imageHeight + packetHeight - 1) / packetHeight;
+
+            struct noisyBlock {
+                double error;
+                int x0, y0, x1, y1;
+                int samples;    // Samples each of the block's pixels has.
+            };
+            std::vector<noisyBlock> noisy;
+
+            for (int round = 1; samplesTaken < budget; round++) {
+                noisy.clear();
+                for (int b = 0; b < blocksX * blocksY; b++) {
+                    noisyBlock block;
+                    block.x0 = (b % blocksX) * packetWidth;
+                    block.y0 = (b / blocksX) * packetHeight;
+                    block.x1 = std::min(block.x0 + packetWidth, imageWidth);
+                    block.y1 = std::min(block.y0 + packetHeight, imageHeight);
+                    block.samples = estimates[size_t(block.y0) * imageWidth + block.x0].samples;
+                    block.error = 0;
+                    for (int j = block.y0; j < block.y1; j++) {
+                        for (int i = block.x0; i < block.x1; i++) {
+                            block.error = std::max(block.error, estimates[size_t(j) * imageWidth + i].error());
+                        }
+                    }
+                    if (block.error > adaptiveThreshold && block.samples < pixelLimit) noisy.push_back(block);
+                }
+                if (noisy.empty()) break;
+
+                std::stable_sort(noisy.begin(), noisy.end(), [](const noisyBlock& a, const noisyBlock& b) {
+                    return a.error > b.error;
+                });
+
+                // Each noisy block doubles its samples, scaled down if the round would overrun the budget.
+                uint64_t requested = 0;
+                for (const auto& block : noisy) {
+                    auto blockPixels = uint64_t(block.x1 - block.x0) * (block.y1 - block.y0);
+                    requested += blockPixels * std::min(block.samples, pixelLimit - block.samples);
+                }
+                auto remaining = budget - samplesTaken;
+                double scale = requested > remaining ? double(remaining) / requested : 1.0;
+
+                // A block too big for what is left of the budget is skipped, so smaller edge blocks can still use it up. A
+                // round that fits no block at all ends the render, since the next one would be the same.
+                bool scheduled = false;
+                for (const auto& block : noisy) {
+                    auto blockPixels = uint64_t(block.x1 - block.x0) * (block.y1 - block.y0);
+                    auto extra = uint64_t(std::min(block.samples, pixelLimit - block.samples) * scale);
+                    extra = std::min(std::max(extra, uint64_t(1)), remaining / blockPixels);
+                    if (extra == 0) continue;
+                    scheduled = true;
+
+                    for (int j = block.y0; j < block.y1; j++) {
+                        for (int i = block.x0; i < block.x1; i++) {
+                            sampleTargets[size_t(j) * imageWidth + i] = block.samples + int(extra);
+                        }
+                    }
+                    remaining -= extra * blockPixels;
+                    samplesTaken += extra * blockPixels;
+                }
+
+                if (!scheduled) break;
+
+                std::clog << "\rAdaptive round " << round << ": " << noisy.size() << " noisy blocks.   \n";
+                renderPass(pool);
+            }
+        }
+
+        void renderTile(int x0, int y0) {
+            // Render the pixels of one tile up to their sample targets. Tiles never overlap, so no locking is needed.
+            int x1 = std::min(x0 + tileSize, regionRight);
+            int y1 = std::min(y0 + tileSize, regionBottom);
+
+            if (packetTracing) {
+                for (int j = y0; j < y1; j += packetHeight) {
+                    for (int i = x0; i < x1; i += packetWidth) {
+                        renderPacket(i, j, std::min(i + packetWidth, x1), std::min(j + packetHeight, y1));
+                    }
+                }
+                return;
+            }
+
+            for (int j = y0; j < y1; j++) {
+                for (int i = x0; i < x1; i++) {
+                    auto& estimate = estimates[size_t(j) * imageWidth + i];
+                    int target = sampleTargets[size_t(j) * imageWidth + i];
+                    for (int sample = estimate.samples; sample < target; sample++) {
+                        // Each sample draws its own random sequence, so it is the same whichever thread renders it.
+                        auto pixel = pixelStream(i, j);
+                        seedRandom(pixel, firstSample + sample);
+
+                        ray r = getRay(i, j);
+                        seedRandom(pixel, firstSample + sample, cameraDimensions);
+                        countStat(statCameraRays);
+
+                        auto costBefore = statsEnabled ? threadStats().traversalCost() : 0;
+                        surfaceFeatures features;
+                        estimate.add(renderIntegrator->rayColour(r, context, nullptr, collectingFeatures ? &features : nullptr));
+                        if (collectingFeatures) estimate.addFeatures(features);
+                        if (statsEnabled) estimate.cost += double(threadStats().traversalCost() - costBefore);
+                    }
+                }
+            }
+        }
+
+        void renderPacket(int x0, int y0, int x1, int y1) {
+            // Render the block of pixels [x0, x1) x [y0, y1), tracing each sample's camera rays for the whole block as one packet.
+            // Pixels may need different sample ranges; each sample's packet holds the pixels that still need that sample.
+            int laneX[rayPacket::size], laneY[rayPacket::size];
+            pixelEstimate* laneEstimate[rayPacket::size];
+            int laneFirst[rayPacket::size], laneEnd[rayPacket::size];
+            int lanes = 0;
+            int blockFirst = std::numeric_limits<int>::max(), blockEnd = 0;
+            for (int j = y0; j < y1; j++) {
+                for (int i = x0; i < x1; i++) {
+                    laneX[lanes] = i;
+                    laneY[lanes] = j;
+                    laneEstimate[lanes] = &estimates[size_t(j) * imageWidth + i];
+                    laneFirst[lanes] = laneEstimate[lanes]->samples;
+                    laneEnd[lanes] = sampleTargets[size_t(j) * imageWidth + i];
+                    blockFirst = std::min(blockFirst, laneFirst[lanes]);
+                    blockEnd = std::max(blockEnd, laneEnd[lanes]);
+                    lanes++;
+                }
+            }
+
+            rayPacket packet;
+            hitRecord recs[rayPacket::size];
+            int packetLane[rayPacket::size];    // The block lane each packet lane belongs to.
+
+            for (int sample = blockFirst; sample < blockEnd; sample++) {
+                packet.count = 0;
+                for (int k = 0; k < lanes; k++) {
+                    if (sample < laneFirst[k] || sample >= laneEnd[k]) continue;
+
+                    auto pixel = pixelStream(laneX[k], laneY[k]);
+                    seedRandom(pixel, firstSample + sample);
+                    packetLane[packet.count] = k;
+                    packet.add(getRay(laneX[k], laneY[k]));
+
+                    seedRandom(pixel, firstSample + sample, cameraDimensions);
+                    packet.random[packet.count - 1] = threadRandomState();
+                }
+                if (packet.count == 0) continue;
+
+                packet.prepare(interval(0.001, infinity));
+                threadRayCount() += packet.count;
+                countStat(statCameraRays, packet.count);
+
+                // The packet's traversal cost is shared evenly between its lanes.
+                auto costBefore = statsEnabled ? threadStats().traversalCost() : 0;
+                if (maxDepth > 0) context.world->hitPacket(packet, recs);
+                double laneCost = statsEnabled ? double(threadStats().traversalCost() - costBefore) / packet.count : 0;
+
+                // Past the first hit each lane continues as a single ray.
+                for (int k = 0; k < packet.count; k++) {
+                    threadRandomState() = packet.random[k];
+                    auto& estimate = *laneEstimate[packetLane[k]];
+                    if (maxDepth <= 0) {
+                        estimate.add(colour(0, 0, 0));
+                        if (collectingFeatures) estimate.addFeatures(surfaceFeatures());
+                        continue;
+                    }
+
+                    costBefore = statsEnabled ? threadStats().traversalCost() : 0;
+                    surfaceFeatures features;
+                    if (packet.hit[k]) {
+                        estimate.add(renderIntegrator->rayColour(packet.rays[k], context, &recs[k], collectingFeatures ? &features : nullptr));
+                    } else {
+                        estimate.add(background);
+                        features.albedo = background;
+                    }
+                    if (collectingFeatures) estimate.addFeatures(features);
+                    if (statsEnabled) estimate.cost += laneCost + double(threadStats().traversalCost() - costBefore);
+                }
+            }
+        }
+
+        accumulationBuffer gatherAccumulation() const {
+            accumulationBuffer result(imageWidth, imageHeight, regionLeft, regionTop, regionRight - regionLeft, regionBottom - regionTop);
+            result.firstSample = firstSample;
+            result.sampleCount = samplesPerPixel;
+            result.job = job;
+            result.job.seed = seed;
+
+            for (int j = regionTop; j < regionBottom; j++) {
+                for (int i = regionLeft; i < regionRight; i++) {
+                    const auto& estimate = estimates[size_t(j) * imageWidth + i];
+                    auto p = size_t(j - regionTop) * result.width + (i - regionLeft);
+                    result.sums[p] = estimate.sum;
+                    result.counts[p] = uint32_t(estimate.samples);
+                }
+            }
+            return result;
+        }
+
+        featureBuffers gatherFeatures() const {
+            // Each pixel's mean features, and how noisy its colour still is.
+            featureBuffers result;
+            result.albedo = framebuffer(imageWidth, imageHeight);
+            result.normal = framebuffer(imageWidth, imageHeight);
+            result.depth.resize(estimates.size());
+            result.variance.resize(estimates.size());
+            result.samples.resize(estimates.size());
+            result.objectId.resize(estimates.size());
+            result.materialId.resize(estimates.size());
+
+            // Objects are numbered in the order the image first shows them, so the ids are the same on every run.
+            std::unordered_map<const hittable*, uint32_t> objectIds;
+
+            for (int j = 0; j < imageHeight; j++) {
+                for (int i = 0; i < imageWidth; i++) {
+                    auto p = size_t(j) * imageWidth + i;
+                    const auto& estimate = estimates[p];
+                    auto scale = estimate.samples > 0 ? 1.0 / estimate.samples : 0.0;
+                    result.albedo.setPixel(i, j, colour(scale * estimate.albedoSum));
+                    auto normal = vec3(scale * estimate.normalSum);
+                    result.normal.setPixel(i, j, normal.lengthSquared() > 0 ? unitVector(normal) : normal);
+                    result.depth[p] = float(scale * estimate.depthSum);
+                    result.variance[p] = float(estimate.brightnessVariance());
+                    result.samples[p] = estimate.samples;
+
+                    if (estimate.firstObject) {
+                        auto found = objectIds.emplace(estimate.firstObject, uint32_t(objectIds.size() + 1)).first;
+                        result.objectId[p] = found->second;
+                        result.materialId[p] = materialRegistry::indexOf(estimate.firstMaterial) + 1;
+                    }
+                }
+            }
+            return result;
+        }
+
+        void writeHeatmap() const {
+            // Write each pixel's traversal cost per sample: raw values to a .pfm, otherwise a blue-green-red ramp scaled to the
+            // most expensive pixel.
+            if (!statsEnabled) {
+                std::cerr << "ERROR: The cost heatmap needs a build with RAYTRACER_STATS.\n";
+                return;
+            }
+
+            std::vector<double> costs(estimates.size());
+            double maxCost = 0;
+            for (size_t p = 0; p < estimates.size(); p++) {
+                costs[p] = estimates[p].samples > 0 ? estimates[p].cost / estimates[p].samples : 0;
+                maxCost = std::max(maxCost, costs[p]);
+            }
+
+            bool raw = isFloatImage(heatmapFile);
+            framebuffer heatmap(imageWidth, imageHeight);
+            for (int j = 0; j < imageHeight; j++) {
+                for (int i = 0; i < imageWidth; i++) {
+                    auto cost = costs[size_t(j) * imageWidth + i];
+                    if (raw) {
+                        heatmap.setPixel(i, j, colour(cost, cost, cost));
+                        continue;
+                    }
+
+                    auto t = maxCost > 0 ? cost / maxCost : 0;
+                    colour ramp = t < 0.5 ? colour(0, 2 * t, 1 - 2 * t) : colour(2 * t - 1, 2 - 2 * t, 0);
+                    heatmap.setPixel(i, j, ramp * ramp);    // Squared, to undo the writers' gamma correction.
+                }
+            }
+
+            std::clog << "Heatmap: up to " << maxCost << " traversal steps per sample.\n";
+            writeImage(heatmap, heatmapFile);
+        }
+
+        uint64_t pixelStream(int i, int j) const {
+            // The random stream of pixel i, j: its index, with the camera's seed in the top bits.
+            return (seed << 40) ^ (uint64_t(j) * imageWidth + i);
+        }
+
         ray getRay(int i, int j) const {
             // Construct a camera ray originating from the origin and directed at randomly sampled point around the pixel location i, j.
 
@@ -112,24 +692,5 @@ class camera {
             auto p = randomInUnitDisk();
             return centre + (p[0] * defocusDiskU) + (p[1] * defocusDiskV);
         }
-
-        colour rayColour(const ray& r, int depth, const hittable& world) const {
-            // If we've exceeded the ray bounce limit, no more light is gathered.
-            if (depth <= 0) return colour(0, 0, 0);
-
-            hitRecord rec;
-
-            // if hte ray hits nothing, return the background colour. 
-            if (!world.hit(r, interval(0.001, infinity), rec)) return background;
-
-            ray scattered;
-            colour attenuation;
-            colour colourFromEmission = rec.mat->emitted(rec.u, rec.v, rec.p);
-
-            if (!rec.mat->scatter(r, rec, attenuation, scattered)) return colourFromEmission;
-
-            colour colourFromScatter = attenuation * rayColour(scattered, depth - 1, world);
-            return colourFromEmission + colourFromScatter;
-        }
 };
 #endif
\ No newline at end of file
@@ -8,21 +8,24 @@
 
 class constantMedium : public hittable {
     public:
-        constantMedium(shared_ptr<hittable> boundary, double density, shared_ptr<texture> tex): boundary(boundary), negInvDensity(-1 / density), phaseFunction(make_shared<isotropic>(tex)) {}
+        constantMedium(shared_ptr<hittable> boundary, double density, shared_ptr<texture> tex): boundary(boundary), negInvDensity(-1 / density), phaseFunction(sceneMaterials().add(make_shared<isotropic>(tex))) {}
 
-        constantMedium(shared_ptr<hittable> boundary, double density, const colour& albedo) : boundary(boundary), negInvDensity(-1 / density), phaseFunction(make_shared<isotropic>(albedo)) {}
+        constantMedium(shared_ptr<hittable> boundary, double density, const colour& albedo) : boundary(boundary), negInvDensity(-1 / density), phaseFunction(sceneMaterials().add(make_shared<isotropic>(albedo))) {}
+
+        bool intersect(const ray& r, interval ray_t, hitRecord& rec) const override {
+            countStat(statMediumTests);
 
-        bool hit(const ray& r, interval ray_t, hitRecord& rec) const override {
             // Print occasional samples when debugging. To enable, set enableDebug true.
             const bool enableDebug = false;
             const bool debugging = enableDebug && randomDouble() < 0.00001;
 
             hitRecord rec1, rec2;
 
-            if (!boundary->hit(r, interval::universe, rec1))
+            // Only the distances to the boundary are needed, so its hits are never completed.
+            if (!boundary->intersect(r, interval::universe, rec1))
                 return false;
 
-            if (!boundary->hit(r, interval(rec1.t+0.0001, infinity), rec2))
+            if (!boundary->intersect(r, interval(rec1.t+0.0001, infinity), rec2))
                 return false;
 
             if (debugging) std::clog << "\nt_min=" << rec1.t << ", t_max=" << rec2.t << '\n';
@@ -54,8 +57,11 @@ class constantMedium : public hittable {
 
             rec.normal = vec3(1,0,0);   // arbitrary
             rec.frontFace = true;       // also arbitrary
+            rec.uvDensity = 0;
             rec.mat = phaseFunction;
+            rec.object = this;
 
+            countStat(statMediumHits);
             return true;
         }
 
@@ -65,8 +71,8 @@ class constantMedium : public hittable {
 
     private:
         shared_ptr<hittable> boundary;
-        double negInvDensity;
-        shared_ptr<material> phaseFunction;
+        real negInvDensity;
+        materialHandle phaseFunction;
     };
 
 #endif
\ No newline at end of file
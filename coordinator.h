@@ -0,0 +1,140 @@
+#ifndef COORDINATOR_H
+#define COORDINATOR_H
+
+#include "rayTracer.h"
+#include "accumulationBuffer.h"
+#include "imageWriter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+* Distributed rendering. A worker is this program run with --shard I/N and --partial FILE: it renders
+* shard I of N and saves its accumulationBuffer. The coordinator starts N workers on this machine,
+* each in its own process, and merges their buffers into the final image. Workers on other machines
+* can write their buffers to a shared directory instead, and --merge joins them.
+*
+* Every sample's random numbers depend only on its pixel, its index and the camera's seed, so a
+* shard renders the same bytes however often it runs, and a failed shard is simply run again.
+*/
+
+inline std::string shardFile(const std::string& directory, int index, int count) {
+    return directory + "/shard_" + std::to_string(index) + "_of_" + std::to_string(count) + ".rtacc";
+}
+
+inline std::string shellQuote(const std::string& argument) {
+    // Single-quote an argument for a POSIX shell, so std::system passes it through unchanged.
+    std::string quoted = "'";
+    for (char c : argument) {
+        if (c == '\'') quoted += "'\\''";
+        else quoted += c;
+    }
+    return quoted + "'";
+}
+
+inline bool mergeShards(const std::vector<std::string>& files, const std::string& outputFile) {
+    // Add the buffers up in the order given, so the result is the same on every run, and write the mean of each pixel. The
+    // buffers must be different shards of one render: shards of another scene, crop, sample range or split would add up
+    // to a wrong image, and two buffers holding the same samples would count them twice.
+    accumulationBuffer merged;
+    std::vector<accumulationBuffer> headers;     // The buffers merged so far, without their sums.
+    for (const auto& file : files) {
+        accumulationBuffer part;
+        if (!part.read(file)) return false;
+
+        if (headers.empty()) {
+            merged = accumulationBuffer(part.imageWidth, part.imageHeight, 0, 0, part.imageWidth, part.imageHeight);
+            merged.job = part.job;
+        }
+        if (!part.job.sameRender(merged.job) || !merged.add(part)) {
+            std::cerr << "ERROR: '" << file << "' belongs to a different render than '" << files[0]
+                      << "': its scene, mesh, noise grid, seed, size, crop, samples or split differ.\n";
+            return false;
+        }
+        for (size_t earlier = 0; earlier < headers.size(); earlier++) {
+            if (part.overlaps(headers[earlier])) {
+                std::cerr << "ERROR: '" << file << "' and '" << files[earlier] << "' hold some of the same samples.\n";
+                return false;
+            }
+        }
+
+        part.sums = {};
+        part.counts = {};
+        headers.push_back(std::move(part));
+    }
+    if (headers.empty()) {
+        std::cerr << "ERROR: No shards to merge.\n";
+        return false;
+    }
+
+    for (int index = 0; index < merged.job.shardCount; index++) {
+        bool present = false;
+        for (const auto& header : headers) present = present || header.job.shardIndex == index;
+        if (!present) std::clog << "Warning: Shard " << index << " of " << merged.job.shardCount << " is missing.\n";
+    }
+    auto missing = merged.missingPixels();
+    if (missing > 0) std::clog << "Warning: " << missing << " pixels have no samples in any shard and stay black.\n";
+    std::clog << "Merged " << files.size() << " shards.\n";
+    return writeImage(merged.resolve(), outputFile);
+}
+
+inline bool runWorkers(const std::string& program, const std::vector<std::string>& options, const renderJob& job,
+                       const std::string& directory, const std::string& outputFile) {
+    // Render every shard of job whose buffer is not already in the directory, one worker process per shard, then merge them
+    // all. A shard's buffer only appears once it is complete, so after a failure, running the same command again renders
+    // just the shards that are missing. A buffer left by a different render, or a different split of this one, is rendered
+    // again.
+    int workers = job.shardCount;
+    std::vector<std::string> files, commands;
+    for (int index = 0; index < workers; index++) {
+        files.push_back(shardFile(directory, index, workers));
+
+        std::string command = shellQuote(program);
+        for (const auto& option : options) command += " " + shellQuote(option);
+        command += " --shard " + std::to_string(index) + "/" + std::to_string(workers);
+        if (job.splitSamples) command += " --split samples";
+        command += " --partial " + shellQuote(files.back());
+        commands.push_back(command);
+    }
+
+    std::vector<int> status(workers, 0);
+    std::vector<std::thread> running;
+    for (int index = 0; index < workers; index++) {
+        if (std::ifstream(files[index])) {
+            renderJob expected = job;
+            expected.shardIndex = index;
+            accumulationBuffer existing;
+            if (existing.read(files[index]) && existing.job == expected) {
+                std::clog << "Shard " << index << " is already rendered.\n";
+                continue;
+            }
+            std::clog << "Shard " << index << " in '" << files[index] << "' is from a different render; rendering it again.\n";
+            std::remove(files[index].c_str());
+        }
+        running.emplace_back([&, index] {
+            // Each worker's progress and errors go to a log next to its buffer, so the workers do not write over each other.
+            status[index] = std::system((commands[index] + " 2> " + shellQuote(files[index] + ".log")).c_str());
+        });
+    }
+    for (auto& worker : running) worker.join();
+
+    bool failed = false;
+    for (int index = 0; index < workers; index++) {
+        if (status[index] != 0 || !std::ifstream(files[index])) {
+            std::cerr << "ERROR: Shard " << index << " failed (see " << files[index] << ".log). To render it again, run:\n    "
+                      << commands[index] << "\n";
+            failed = true;
+        }
+    }
+    if (failed) return false;
+
+    return mergeShards(files, outputFile);
+}
+
+#endif
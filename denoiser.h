@@ -0,0 +1,204 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include "rayTracer.h"
+#include "framebuffer.h"
+#include "threadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+class featureBuffers {
+    // Per-pixel guides for the denoiser, averaged over each pixel's samples like the image itself, and the ids the camera
+    // writes out with them as AOVs.
+  public:
+    framebuffer albedo;             // First-hit reflectance (see surfaceFeatures).
+    framebuffer normal;             // Direction of the mean first-hit shading normal, zero where every camera ray missed.
+    std::vector<float> depth;       // First-hit distance from the camera, 0 where every camera ray missed.
+    std::vector<float> variance;    // Variance of each pixel's mean (unclamped) luminance: how noisy the pixel still is.
+    std::vector<int> samples;       // Samples each pixel took.
+    std::vector<uint32_t> objectId;     // Object hit by the pixel's first sample, numbered from 1 in scanline order; 0 for a miss.
+    std::vector<uint32_t> materialId;   // That hit's material's index in its registry plus 1; 0 for a miss.
+
+    bool empty() const {
+        return depth.empty();
+    }
+};
+
+class denoiser {
+    /*
+    * An edge-avoiding a-trous wavelet filter (Dammertz et al. 2010), with the luminance test of
+    * SVGF (Schied et al. 2017), which scales the test by each pixel's own noise.
+    *
+    * The image is first divided by the albedo, so that textures stay out of the blur, and is
+    * multiplied back at the end. Each of the `iterations` passes then blurs with a 5x5 B3-spline
+    * kernel whose taps are 1, 2, 4, ... pixels apart: five passes reach 31 pixels in every
+    * direction for 125 taps per pixel. A tap counts for less where its normal, depth or albedo
+    * differs from the centre pixel's, or its brightness differs by more than the centre's noise
+    * explains, so edges and shadow boundaries stay sharp while flat noisy regions are averaged.
+    */
+  public:
+    int iterations = 5;
+    double normalPower = 128;       // A tap's normal weight is max(0, n . n_tap)^normalPower.
+    double depthSigma = 1;          // Depth tolerance, in units of the change the local depth slope predicts.
+    double albedoSigma = 0.1;       // Albedo tolerance.
+    double luminanceSigma = 4;      // Luminance tolerance, in standard deviations of the centre pixel's noise.
+
+    framebuffer denoise(const framebuffer& image, const featureBuffers& guides, threadPool& pool) const {
+        int width = image.width(), height = image.height();
+        auto pixelCount = size_t(width) * height;
+
+        // Demodulate: filter the light arriving at each surface, not the surface's texture.
+        std::vector<colour> divisor(pixelCount), irradiance(pixelCount);
+        std::vector<vec3> normal(pixelCount);
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                auto p = size_t(j) * width + i;
+                auto albedo = guides.albedo.pixel(i, j);
+                auto pixel = image.pixel(i, j);
+                for (int c = 0; c < 3; c++) {
+                    divisor[p][c] = albedo[c] > 0.01 ? albedo[c] : 1;
+                    irradiance[p][c] = pixel[c] / divisor[p][c];
+                }
+
+                auto n = guides.normal.pixel(i, j);
+                normal[p] = n.lengthSquared() > 0 ? unitVector(n) : vec3(0, 0, 0);
+            }
+        }
+
+        auto slopes = depthSlopes(guides.depth, width, height);
+        std::vector<float> variance = guides.variance;
+        std::vector<colour> filtered(pixelCount);
+        std::vector<float> filteredVariance(pixelCount);
+        std::vector<float> blurredVariance(pixelCount);
+
+        for (int iteration = 0; iteration < iterations; iteration++) {
+            int step = 1 << iteration;
+            blurVariance(variance, blurredVariance, width, height);
+
+            pool.parallelFor(height, [&](int j) {
+                for (int i = 0; i < width; i++) {
+                    auto p = size_t(j) * width + i;
+                    auto centreLuminance = luminance(irradiance[p] * divisor[p]);
+                    auto luminanceTolerance = luminanceSigma * std::sqrt(double(blurredVariance[p])) + 1e-6;
+                    auto albedo = guides.albedo.pixel(i, j);
+
+                    colour sum(0, 0, 0);
+                    double weightSum = 0, varianceSum = 0;
+                    for (int dy = -2; dy <= 2; dy++) {
+                        int y = j + dy * step;
+                        if (y < 0 || y >= height) continue;
+                        for (int dx = -2; dx <= 2; dx++) {
+                            int x = i + dx * step;
+                            if (x < 0 || x >= width) continue;
+                            auto q = size_t(y) * width + x;
+
+                            double weight = kernel[dx + 2] * kernel[dy + 2];
+                            if (q != p) {
+                                weight *= normalWeight(normal[p], normal[q]);
+                                weight *= depthWeight(guides.depth[p], guides.depth[q], slopes[p], dx * step, dy * step);
+                                weight *= std::exp(-(albedo - guides.albedo.pixel(x, y)).lengthSquared() / (albedoSigma * albedoSigma));
+                                weight *= std::exp(-std::fabs(centreLuminance - luminance(irradiance[q] * divisor[q])) / luminanceTolerance);
+                            }
+
+                            sum += weight * irradiance[q];
+                            weightSum += weight;
+                            varianceSum += weight * weight * variance[q];
+                        }
+                    }
+
+                    // The centre tap always has weight, so weightSum > 0.
+                    filtered[p] = sum / weightSum;
+                    filteredVariance[p] = float(varianceSum / (weightSum * weightSum));
+                }
+            });
+
+            std::swap(irradiance, filtered);
+            std::swap(variance, filteredVariance);
+        }
+
+        framebuffer result(width, height);
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                auto p = size_t(j) * width + i;
+                result.setPixel(i, j, irradiance[p] * divisor[p]);
+            }
+        }
+        return result;
+    }
+
+  private:
+    static constexpr double kernel[5] = {1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16};
+
+    static double luminance(const colour& c) {
+        return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+    }
+
+    double normalWeight(const vec3& a, const vec3& b) const {
+        // Pixels where the camera rays missed have no normal; they only match each other.
+        bool aMissed = a.lengthSquared() == 0, bMissed = b.lengthSquared() == 0;
+        if (aMissed || bMissed) return aMissed == bMissed ? 1 : 0;
+        return std::pow(std::fmax(0.0, double(dot(a, b))), normalPower);
+    }
+
+    double depthWeight(float a, float b, const std::pair<float, float>& slope, int dx, int dy) const {
+        if (a == 0 || b == 0) return a == b ? 1 : 0;
+        auto expected = std::fabs(slope.first * dx) + std::fabs(slope.second * dy);
+        return std::exp(-std::fabs(double(a) - b) / (depthSigma * expected + 1e-4 * a));
+    }
+
+    static std::vector<std::pair<float, float>> depthSlopes(const std::vector<float>& depth, int width, int height) {
+        // Depth change per pixel across and down the image. The smaller of the one-sided differences is used, so a pixel on a
+        // silhouette takes the slope of its own surface rather than the jump to the one behind.
+        std::vector<std::pair<float, float>> slopes(depth.size());
+        auto slope = [&](size_t p, int i, int j, int di, int dj) {
+            float best = 0;
+            bool found = false;
+            for (int side = -1; side <= 1; side += 2) {
+                int x = i + side * di, y = j + side * dj;
+                if (x < 0 || x >= width || y < 0 || y >= height) continue;
+                auto q = size_t(y) * width + x;
+                if (depth[q] == 0) continue;
+                auto difference = std::fabs(depth[q] - depth[p]);
+                if (!found || difference < best) best = difference;
+                found = true;
+            }
+            return best;
+        };
+
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                auto p = size_t(j) * width + i;
+                if (depth[p] == 0) continue;
+                slopes[p] = std::make_pair(slope(p, i, j, 1, 0), slope(p, i, j, 0, 1));
+            }
+        }
+        return slopes;
+    }
+
+    static void blurVariance(const std::vector<float>& variance, std::vector<float>& blurred, int width, int height) {
+        // A 3x3 Gaussian, so one unlucky pixel's variance estimate does not decide its luminance tolerance alone.
+        static const float weights[3] = {0.25f, 0.5f, 0.25f};
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                float sum = 0, weightSum = 0;
+                for (int dy = -1; dy <= 1; dy++) {
+                    int y = j + dy;
+                    if (y < 0 || y >= height) continue;
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int x = i + dx;
+                        if (x < 0 || x >= width) continue;
+                        auto weight = weights[dx + 1] * weights[dy + 1];
+                        sum += weight * variance[size_t(y) * width + x];
+                        weightSum += weight;
+                    }
+                }
+                blurred[size_t(j) * width + i] = sum / weightSum;
+            }
+        }
+    }
+};
+
+#endif
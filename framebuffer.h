@@ -0,0 +1,49 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "rayTracer.h"
+
+#include <vector>
+
+class framebuffer {
+    public:
+        framebuffer() {}
+
+        framebuffer(int width, int height) : imageWidth(width), imageHeight(height), data(size_t(width) * height * 3, 0.0f) {}
+
+        int width() const {
+            return imageWidth;
+        }
+
+        int height() const {
+            return imageHeight;
+        }
+
+        void setPixel(int x, int y, const colour& pixelColour) {
+            float* pixel = &data[(size_t(y) * imageWidth + x) * 3];
+            pixel[0] = float(pixelColour.x());
+            pixel[1] = float(pixelColour.y());
+            pixel[2] = float(pixelColour.z());
+        }
+
+        colour pixel(int x, int y) const {
+            const float* pixel = &data[(size_t(y) * imageWidth + x) * 3];
+            return colour(pixel[0], pixel[1], pixel[2]);
+        }
+
+        const float* pixels() const {
+            // Linear RGB floats, three per pixel, left to right then top to bottom.
+            return data.data();
+        }
+
+        size_t componentCount() const {
+            return data.size();
+        }
+
+    private:
+        int imageWidth = 0;
+        int imageHeight = 0;
+        std::vector<float> data;
+};
+
+#endif
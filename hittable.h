@@ -3,18 +3,26 @@
 
 #include "rayTracer.h"
 #include "aabb.h"
+#include "rayPacket.h"
 
 class material;
+class hittable;
+
+using materialHandle = uint32_t;    // A material in a materialRegistry: the registry's tag in the top 8 bits, its index below.
 
 class hitRecord {
     public: 
         point3 p;
         vec3 normal;
-        shared_ptr<material> mat;
-        double t;
-        double u;
-        double v;
+        materialHandle mat = 0;
+        real t;
+        real u;
+        real v;
         bool frontFace;
+        real uvDensity = 0;                 // uv units per unit of surface length near p, or 0 if uv is not a surface mapping.
+        real footprint = 0;                 // Width of the ray's cone at p in uv units, set by the integrator.
+        const hittable* object = nullptr;   // What was hit; its completeHit() fills in the surface.
+        uint32_t primitive = 0;             // Which of the object's primitives was hit, e.g. a mesh triangle.
 
         void setFaceNormal(const ray& r, const vec3& outwardNormal) {
             /* 
@@ -28,19 +36,79 @@ class hitRecord {
 };
 
 class hittable {
+    /*
+    * Hits are found in two phases. intersect() searches for the closest hit and records only its
+    * t, the object hit and whatever that object needs to finish the job later (rec.primitive,
+    * and in rec.u and rec.v, e.g. barycentrics). completeHit() then fills in the point, normal,
+    * texture coordinates and material, once, for the closest hit alone. Normals, uv mapping and
+    * material references are never computed for candidates that a closer hit later replaces.
+    *
+    * Objects that transform or wrap others (translate, rotateY, instance, constantMedium) finish
+    * their inner hit inside intersect(), since the surface must be found in their own space, and
+    * leave the default completeHit(), which does nothing.
+    */
     public:
     virtual ~hittable() = default;
 
-    virtual bool hit(const ray& r, interval rayT, hitRecord& rec) const = 0; 
+    virtual bool intersect(const ray& r, interval rayT, hitRecord& rec) const = 0;
+
+    virtual void completeHit(const ray& r, hitRecord& rec) const {
+        (void)r;
+        (void)rec;
+    }
+
+    bool hit(const ray& r, interval rayT, hitRecord& rec) const {
+        // Find the closest hit in rayT and fill in its whole record.
+        if (!intersect(r, rayT, rec)) return false;
+        rec.object->completeHit(r, rec);
+        return true;
+    }
+
+    virtual void intersectPacket(rayPacket& packet, hitRecord recs[]) const {
+        // Intersect every lane of the packet, updating the lanes' closest hits. By default each lane is traced as a single ray.
+        for (int k = 0; k < packet.count; k++) {
+            threadRandomState() = packet.random[k];
+            if (intersect(packet.rays[k], interval(packet.tMin, packet.tMax[k]), recs[k])) {
+                packet.recordHit(k, recs[k].t);
+            }
+            packet.random[k] = threadRandomState();
+        }
+    }
+
+    void hitPacket(rayPacket& packet, hitRecord recs[]) const {
+        // Find every lane's closest hit, then fill in the records of the lanes that hit something.
+        intersectPacket(packet, recs);
+        for (int k = 0; k < packet.count; k++) {
+            if (packet.hit[k]) recs[k].object->completeHit(packet.rays[k], recs[k]);
+        }
+    }
 
     virtual aabb boundingBox() const = 0;
+
+    // Lights are sampled through these two, so that the integrator can aim rays at them. random() returns a direction from
+    // origin towards a random point of the object and pdfValue() the solid-angle density with which random() picks a given
+    // direction. Objects that cannot be sampled return a density of 0.
+    virtual real pdfValue(const point3& origin, const vec3& direction) const {
+        (void)origin;
+        (void)direction;
+        return 0;
+    }
+
+    virtual vec3 random(const point3& origin) const {
+        (void)origin;
+        return vec3(1, 0, 0);
+    }
 };
 
 class translate : public hittable {
     public:
-        translate(shared_ptr<hittable> object, const vec3& offset) : object(object), offset(offset) {}
+        translate(shared_ptr<hittable> object, const vec3& offset) : object(object), offset(offset) {
+            bBox = object->boundingBox() + offset;
+        }
+
+        bool intersect(const ray& r, interval rayT, hitRecord& rec) const override {
+            countStat(statTranslateTests);
 
-        bool hit(const ray& r, interval rayT, hitRecord& rec) const override {
             // Move the ray backwards by the offset.
             ray offsetR(r.origin() - offset, r.direction(), r.time());
 
@@ -50,7 +118,9 @@ class translate : public hittable {
 
             // Move the intersection point forwards by the offset
             rec.p += offset;
+            rec.object = this;
 
+            countStat(statTranslateHits);
             return true;
         }
 
@@ -66,7 +136,7 @@ class translate : public hittable {
 
 class rotateY : public hittable {
     public: 
-        rotateY(shared_ptr<hittable> object, double angle) : object(object) {
+        rotateY(shared_ptr<hittable> object, real angle) : object(object) {
             auto radians = degreesToRadians(angle);
             sinTheta = sin(radians);
             cosTheta = cos(radians);
@@ -98,7 +168,9 @@ class rotateY : public hittable {
             bBox = aabb(min, max);
         }
 
-        bool hit(const ray& r, interval rayT, hitRecord& rec) const override {
+        bool intersect(const ray& r, interval rayT, hitRecord& rec) const override {
+            countStat(statRotateYTests);
+
             // Change the ray from world space to object space. 
             auto origin = r.origin();
             auto direction = r.direction();
@@ -118,7 +190,7 @@ class rotateY : public hittable {
             // Change the intersection point from object space to world space. 
             auto p = rec.p;
             p[0] = cosTheta * rec.p[0] + sinTheta * rec.p[2];
-            p[2] = -sinTheta * rec.p[0] + cosTheta * rec.normal[2];
+            p[2] = -sinTheta * rec.p[0] + cosTheta * rec.p[2];
 
             // Change the normal from object space to world space. 
             auto normal = rec.normal;
@@ -127,7 +199,9 @@ class rotateY : public hittable {
 
             rec.p = p;
             rec.normal = normal;
+            rec.object = this;
 
+            countStat(statRotateYHits);
             return true;
         }
 
@@ -137,8 +211,8 @@ class rotateY : public hittable {
 
     private: 
         shared_ptr<hittable> object;
-        double sinTheta;
-        double cosTheta;
+        real sinTheta;
+        real cosTheta;
         aabb bBox;
 };
 
@@ -27,26 +27,44 @@ class hittableList : public hittable {
             bBox = aabb(bBox, object->boundingBox());
         }
 
-        bool hit (const ray& r, interval rayT, hitRecord& rec) const override {
-            hitRecord temporaryRec;
+        bool intersect(const ray& r, interval rayT, hitRecord& rec) const override {
+            // A miss leaves rec untouched, so each closer hit can be recorded straight into it.
             bool hitAnything = false;
 
             auto closestSoFar = rayT.max;
 
             for (const auto& object : objects) {
-               if (object->hit(r, interval(rayT.min, closestSoFar), temporaryRec)) {
+               if (object->intersect(r, interval(rayT.min, closestSoFar), rec)) {
                     hitAnything = true;
-                    closestSoFar = temporaryRec.t;
-                    rec = temporaryRec;
+                    closestSoFar = rec.t;
                 }
             }
 
             return hitAnything;
         }
 
+        void intersectPacket(rayPacket& packet, hitRecord recs[]) const override {
+            for (const auto& object : objects) {
+                object->intersectPacket(packet, recs);
+            }
+        }
+
         aabb boundingBox() const override { 
             return bBox;
         }
+
+        real pdfValue(const point3& origin, const vec3& direction) const override {
+            // random() picks each object with the same probability, so the density is the average of theirs.
+            if (objects.empty()) return 0;
+
+            real sum = 0;
+            for (const auto& object : objects) sum += object->pdfValue(origin, direction);
+            return sum / objects.size();
+        }
+
+        vec3 random(const point3& origin) const override {
+            return objects[randomInt(0, int(objects.size()) - 1)]->random(origin);
+        }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,203 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "rayTracer.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#endif
+
+inline void quantizeToBytes(const framebuffer& image, std::vector<unsigned char>& bytes) {
+    // Gamma-correct (gamma 2) and quantise every component to [0, 255] in one pass. The loop is branch-free so the compiler can vectorise it.
+    size_t count = image.componentCount();
+    const float* in = image.pixels();
+    bytes.resize(count);
+
+    for (size_t i = 0; i < count; i++) {
+        float c = in[i] > 0.0f ? in[i] : 0.0f;
+        c = std::sqrt(c);
+        c = c < 0.999f ? c : 0.999f;
+        bytes[i] = (unsigned char)(255.0f * c);
+    }
+}
+
+class imageWriter {
+    public:
+        virtual ~imageWriter() = default;
+
+        virtual void write(std::ostream& out, const framebuffer& image) const = 0;
+};
+
+class ppmWriter : public imageWriter {
+    public:
+        void write(std::ostream& out, const framebuffer& image) const override {
+            // Binary (P6) PPM: a short text header followed by the raw 8-bit RGB data.
+            std::vector<unsigned char> bytes;
+            quantizeToBytes(image, bytes);
+
+            out << "P6\n" << image.width() << ' ' << image.height() << "\n255\n";
+            out.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+        }
+};
+
+class pfmWriter : public imageWriter {
+    public:
+        void write(std::ostream& out, const framebuffer& image) const override {
+            // Portable float map: linear, unclamped 32-bit floats, scanlines stored bottom to top. A negative scale marks little-endian data.
+            const uint16_t endianTest = 1;
+            bool littleEndian = *reinterpret_cast<const unsigned char*>(&endianTest) == 1;
+
+            out << "PF\n" << image.width() << ' ' << image.height() << '\n' << (littleEndian ? "-1.0" : "1.0") << '\n';
+
+            auto rowFloats = size_t(image.width()) * 3;
+            for (int y = image.height() - 1; y >= 0; y--) {
+                out.write(reinterpret_cast<const char*>(image.pixels() + y * rowFloats), std::streamsize(rowFloats * sizeof(float)));
+            }
+        }
+};
+
+class pngWriter : public imageWriter {
+    public:
+        void write(std::ostream& out, const framebuffer& image) const override {
+            // 8-bit RGB PNG. The image data is stored in uncompressed deflate blocks, which keeps the writer small and fast.
+            std::vector<unsigned char> bytes;
+            quantizeToBytes(image, bytes);
+
+            auto rowBytes = size_t(image.width()) * 3;
+            std::vector<unsigned char> scanlines;
+            scanlines.reserve((rowBytes + 1) * image.height());
+            for (int y = 0; y < image.height(); y++) {
+                scanlines.push_back(0); // Filter type: none.
+                scanlines.insert(scanlines.end(), bytes.begin() + y * rowBytes, bytes.begin() + (y + 1) * rowBytes);
+            }
+
+            std::vector<unsigned char> header;
+            putBigEndian(header, uint32_t(image.width()));
+            putBigEndian(header, uint32_t(image.height()));
+            header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bits per channel, RGB, deflate, no filter, no interlace.
+
+            static const unsigned char signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+            out.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+            writeChunk(out, "IHDR", header);
+            writeChunk(out, "IDAT", storedZlibStream(scanlines));
+            writeChunk(out, "IEND", {});
+        }
+
+    private:
+        static void putBigEndian(std::vector<unsigned char>& buffer, uint32_t value) {
+            buffer.push_back((unsigned char)(value >> 24));
+            buffer.push_back((unsigned char)(value >> 16));
+            buffer.push_back((unsigned char)(value >> 8));
+            buffer.push_back((unsigned char)(value));
+        }
+
+        static uint32_t crc32(const unsigned char* data, size_t length, uint32_t crc) {
+            struct crcTable {
+                uint32_t entries[256];
+
+                crcTable() {
+                    for (uint32_t n = 0; n < 256; n++) {
+                        uint32_t c = n;
+                        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                        entries[n] = c;
+                    }
+                }
+            };
+            static const crcTable table;
+
+            for (size_t i = 0; i < length; i++) crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+            return crc;
+        }
+
+        static std::vector<unsigned char> storedZlibStream(const std::vector<unsigned char>& data) {
+            std::vector<unsigned char> stream = {0x78, 0x01};
+
+            const size_t maxBlock = 65535;
+            size_t offset = 0;
+            do {
+                size_t length = std::min(maxBlock, data.size() - offset);
+                bool last = offset + length == data.size();
+                stream.push_back(last ? 1 : 0);
+                stream.push_back((unsigned char)(length & 0xff));
+                stream.push_back((unsigned char)(length >> 8));
+                stream.push_back((unsigned char)(~length & 0xff));
+                stream.push_back((unsigned char)((~length >> 8) & 0xff));
+                stream.insert(stream.end(), data.begin() + offset, data.begin() + offset + length);
+                offset += length;
+            } while (offset < data.size());
+
+            // Adler-32 checksum of the uncompressed data.
+            uint32_t a = 1, b = 0;
+            for (auto byte : data) {
+                a = (a + byte) % 65521;
+                b = (b + a) % 65521;
+            }
+            putBigEndian(stream, (b << 16) | a);
+            return stream;
+        }
+
+        static void writeChunk(std::ostream& out, const char* type, const std::vector<unsigned char>& data) {
+            std::vector<unsigned char> chunk;
+            putBigEndian(chunk, uint32_t(data.size()));
+            chunk.insert(chunk.end(), type, type + 4);
+            chunk.insert(chunk.end(), data.begin(), data.end());
+
+            uint32_t crc = crc32(chunk.data() + 4, chunk.size() - 4, 0xffffffffu) ^ 0xffffffffu;
+            putBigEndian(chunk, crc);
+            out.write(reinterpret_cast<const char*>(chunk.data()), std::streamsize(chunk.size()));
+        }
+};
+
+inline std::string imageExtension(const std::string& filename) {
+    // The file's extension in lower case, or an empty string if it has none.
+    auto dot = filename.rfind('.');
+    auto extension = dot == std::string::npos ? std::string() : filename.substr(dot + 1);
+    for (auto& c : extension) c = char(std::tolower((unsigned char)c));
+    return extension;
+}
+
+inline bool isFloatImage(const std::string& filename) {
+    // Whether makeImageWriter() writes this file with raw float values, rather than tone mapped to 8 bits.
+    return imageExtension(filename) == "pfm";
+}
+
+inline shared_ptr<imageWriter> makeImageWriter(const std::string& filename) {
+    // Pick the writer from the file extension. Anything unrecognised (including standard output) is written as binary PPM.
+    auto extension = imageExtension(filename);
+    if (extension == "png") return make_shared<pngWriter>();
+    if (isFloatImage(filename)) return make_shared<pfmWriter>();
+    return make_shared<ppmWriter>();
+}
+
+inline bool writeImage(const framebuffer& image, const std::string& filename) {
+    // Write the image to the named file, or to standard output if the name is empty or "-". Returns false if the file cannot be written.
+    auto writer = makeImageWriter(filename);
+
+    if (filename.empty() || filename == "-") {
+        #ifdef _WIN32
+            _setmode(_fileno(stdout), _O_BINARY);
+        #endif
+        writer->write(std::cout, image);
+        std::cout.flush();
+        return bool(std::cout);
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "ERROR: Could not open output file '" << filename << "'.\n";
+        return false;
+    }
+    writer->write(file, image);
+    return bool(file);
+}
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rayTracer.h"
+#include "aabb.h"
+#include "hittable.h"
+
+class affineTransform {
+    /*
+    * A 3x4 matrix: a linear part (rotation, scale, shear) in the first three columns and a
+    * translation in the fourth. Points use the translation, vectors do not.
+    */
+  public:
+    real m[3][4];
+
+    affineTransform() {
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 4; c++) m[r][c] = r == c ? 1 : 0;
+        }
+    }
+
+    static affineTransform translation(const vec3& offset) {
+        affineTransform result;
+        for (int r = 0; r < 3; r++) result.m[r][3] = offset[r];
+        return result;
+    }
+
+    static affineTransform scaling(const vec3& scale) {
+        affineTransform result;
+        for (int r = 0; r < 3; r++) result.m[r][r] = scale[r];
+        return result;
+    }
+
+    static affineTransform rotation(const vec3& axis, real degrees) {
+        // Rotation by `degrees` about `axis`, counterclockwise when looking down the axis towards the origin.
+        auto a = unitVector(axis);
+        auto radians = degreesToRadians(degrees);
+        auto s = sin(radians), c = cos(radians), t = 1 - c;
+
+        affineTransform result;
+        result.m[0][0] = t * a.x() * a.x() + c;
+        result.m[0][1] = t * a.x() * a.y() - s * a.z();
+        result.m[0][2] = t * a.x() * a.z() + s * a.y();
+        result.m[1][0] = t * a.x() * a.y() + s * a.z();
+        result.m[1][1] = t * a.y() * a.y() + c;
+        result.m[1][2] = t * a.y() * a.z() - s * a.x();
+        result.m[2][0] = t * a.x() * a.z() - s * a.y();
+        result.m[2][1] = t * a.y() * a.z() + s * a.x();
+        result.m[2][2] = t * a.z() * a.z() + c;
+        return result;
+    }
+
+    affineTransform operator*(const affineTransform& other) const {
+        // The transform that applies `other` first, then this one.
+        affineTransform result;
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 4; c++) {
+                result.m[r][c] = m[r][0] * other.m[0][c] + m[r][1] * other.m[1][c] + m[r][2] * other.m[2][c] + (c == 3 ? m[r][3] : 0);
+            }
+        }
+        return result;
+    }
+
+    point3 applyToPoint(const point3& p) const {
+        return point3(
+            m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+            m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+            m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]
+        );
+    }
+
+    vec3 applyToVector(const vec3& v) const {
+        return vec3(
+            m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+            m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+            m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z()
+        );
+    }
+
+    vec3 applyTransposeToVector(const vec3& v) const {
+        // Normals transform by the inverse transpose, so an instance applies the transpose of its cached inverse to them.
+        return vec3(
+            m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+            m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+            m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z()
+        );
+    }
+
+    affineTransform inverse() const {
+        // Invert the linear part by its adjugate, then undo the translation. The transform must not be singular.
+        affineTransform result;
+        auto cofactor = [this](int r0, int r1, int c0, int c1) { return m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]; };
+
+        result.m[0][0] = cofactor(1, 2, 1, 2);
+        result.m[0][1] = -cofactor(0, 2, 1, 2);
+        result.m[0][2] = cofactor(0, 1, 1, 2);
+        result.m[1][0] = -cofactor(1, 2, 0, 2);
+        result.m[1][1] = cofactor(0, 2, 0, 2);
+        result.m[1][2] = -cofactor(0, 1, 0, 2);
+        result.m[2][0] = cofactor(1, 2, 0, 1);
+        result.m[2][1] = -cofactor(0, 2, 0, 1);
+        result.m[2][2] = cofactor(0, 1, 0, 1);
+
+        auto determinant = m[0][0] * result.m[0][0] + m[0][1] * result.m[1][0] + m[0][2] * result.m[2][0];
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) result.m[r][c] /= determinant;
+        }
+
+        auto offset = result.applyToVector(vec3(m[0][3], m[1][3], m[2][3]));
+        for (int r = 0; r < 3; r++) result.m[r][3] = -offset[r];
+        return result;
+    }
+};
+
+class instance : public hittable {
+    /*
+    * One placement of a shared object (usually a bvh_node or a triangleMesh, the bottom-level
+    * structure) under a general affine transform. Any number of instances can share one object,
+    * which exists once in memory; a bvh_node over the instances is the top-level structure.
+    *
+    * Rays are taken into object space with the cached inverse, so a hit costs one ray transform
+    * however the instance is rotated, scaled and moved. Affine maps keep ray parameters, so the
+    * object-space t is also the world-space t.
+    */
+  public:
+    instance(shared_ptr<hittable> object, const affineTransform& objectToWorld)
+      : object(object), objectToWorld(objectToWorld), worldToObject(objectToWorld.inverse())
+    {
+        // Bound the transformed corners of the object's box.
+        auto objectBox = object->boundingBox();
+        point3 min(infinity, infinity, infinity);
+        point3 max(-infinity, -infinity, -infinity);
+
+        for (int i = 0; i < 8; i++) {
+            point3 corner(
+                (i & 1) ? objectBox.x.max : objectBox.x.min,
+                (i & 2) ? objectBox.y.max : objectBox.y.min,
+                (i & 4) ? objectBox.z.max : objectBox.z.min
+            );
+            auto p = objectToWorld.applyToPoint(corner);
+            for (int c = 0; c < 3; c++) {
+                min[c] = fmin(min[c], p[c]);
+                max[c] = fmax(max[c], p[c]);
+            }
+        }
+
+        bBox = aabb(min, max);
+
+        // Surface lengths grow by about the cube root of the determinant, so uv density shrinks by it.
+        auto l = objectToWorld.m;
+        auto determinant = l[0][0] * (l[1][1] * l[2][2] - l[1][2] * l[2][1])
+                         - l[0][1] * (l[1][0] * l[2][2] - l[1][2] * l[2][0])
+                         + l[0][2] * (l[1][0] * l[2][1] - l[1][1] * l[2][0]);
+        meanScale = std::cbrt(fabs(determinant));
+    }
+
+    bool intersect(const ray& r, interval rayT, hitRecord& rec) const override {
+        countStat(statInstanceTests);
+
+        ray objectRay(worldToObject.applyToPoint(r.origin()), worldToObject.applyToVector(r.direction()), r.time());
+        if (!object->hit(objectRay, rayT, rec)) return false;
+
+        // The hit record's normal already faces against the object-space ray; the inverse transpose keeps it facing against the
+        // world-space ray.
+        rec.p = objectToWorld.applyToPoint(rec.p);
+        rec.normal = unitVector(worldToObject.applyTransposeToVector(rec.normal));
+        rec.uvDensity /= meanScale;
+        rec.object = this;
+
+        countStat(statInstanceHits);
+        return true;
+    }
+
+    aabb boundingBox() const override {
+        return bBox;
+    }
+
+  private:
+    shared_ptr<hittable> object;
+    affineTransform objectToWorld;
+    affineTransform worldToObject;
+    real meanScale;     // Cube root of the linear part's determinant.
+    aabb bBox;
+};
+
+#endif
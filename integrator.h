@@ -0,0 +1,170 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include "rayTracer.h"
+#include "hittable.h"
+#include "material.h"
+
+inline uint64_t& threadRayCount(void) {
+    // Rays traced by the calling thread. Integrators count every ray they trace, so the camera can report rays per second.
+    thread_local uint64_t count = 0;
+    return count;
+}
+
+class renderContext {
+    // The scene and the camera settings an integrator needs to follow a path.
+  public:
+    const hittable* world = nullptr;
+    const hittable* lights = nullptr;   // Emitters to sample directly (next-event estimation), or null to rely on scattering alone.
+    const materialRegistry* materials = nullptr;    // The registry the world's material handles index.
+    colour background;      // Radiance of rays that leave the scene.
+    int maxDepth = 10;      // Maximum number of ray bounces into the scene.
+    int rouletteDepth = 3;  // Bounces every path gets before Russian roulette may end it.
+    real pixelSpread = 0;   // Angle one pixel subtends at the camera: how fast each camera ray's cone widens.
+};
+
+class surfaceFeatures {
+    // What a camera ray's first hit looks like apart from its lighting: the guides a denoiser filters by, and the camera's AOVs.
+  public:
+    colour albedo;          // The first surface's attenuation, or its emission up to 1 for a light; the background for a miss.
+    vec3 normal;            // The first surface's shading normal, zero for a miss.
+    real depth = 0;         // Distance from the camera to the first surface, 0 for a miss.
+    const hittable* object = nullptr;   // The object hit (hitRecord::object), null for a miss.
+    materialHandle mat = 0;             // Its material, meaningless for a miss.
+};
+
+class integrator {
+  public:
+    virtual ~integrator() = default;
+
+    // Returns the light arriving along the camera ray r. If firstHit is not null it is r's closest hit, already found (e.g.
+    // by packet tracing), and the integrator starts shading from it instead of tracing r again. If features is not null the
+    // integrator also fills it in from r's first hit.
+    virtual colour rayColour(const ray& r, const renderContext& context, const hitRecord* firstHit = nullptr,
+                             surfaceFeatures* features = nullptr) const = 0;
+};
+
+class pathIntegrator : public integrator {
+    /*
+    * Unidirectional path tracing, written as a loop rather than a recursion.
+    *
+    * The path's throughput (the product of the attenuations so far) scales what each later vertex
+    * emits, so one hit record and one ray are live at any depth and the stack stays the same size
+    * however long the path is.
+    *
+    * With context.lights set, every vertex on a material with a scatteringPdf() also samples a
+    * direction towards the lights and traces a shadow ray along it. Light reaching such a vertex is
+    * then found twice, by the shadow ray and by the scattered ray, and the two are combined by
+    * multiple importance sampling with the balance heuristic: each is weighted by its density over
+    * the sum of both, so the weights add up to one. Small, distant lights are mostly found by the
+    * shadow rays, large, close ones by scattering. Vertices on specular materials only scatter,
+    * and what their rays hit counts in full.
+    *
+    * After rouletteDepth bounces, a path whose throughput has fallen below 1 survives each further
+    * bounce with a probability equal to its brightest channel, and a survivor's throughput is
+    * divided by that probability. Dark paths mostly end early, the paths that continue carry their
+    * share, and the image stays unbiased; maxDepth is only a hard cap.
+    */
+  public:
+    colour rayColour(const ray& r, const renderContext& context, const hitRecord* firstHit = nullptr,
+                     surfaceFeatures* features = nullptr) const override {
+        colour radiance(0, 0, 0);
+        colour throughput(1, 1, 1);
+        ray current = r;
+        hitRecord rec;
+        real coneWidth = 0;     // Width of the pixel's ray cone where the path is now. It keeps widening after each bounce.
+        real scatterPdf = 0;    // Density with which the last vertex's material picked current's direction, 0 if it was not sampled.
+
+        for (int depth = 0; depth < context.maxDepth; depth++) {
+            if (depth == 0 && firstHit) {
+                rec = *firstHit;
+            } else {
+                threadRayCount()++;
+                if (depth > 0) countStat(statBounces);
+                if (!context.world->hit(current, interval(0.001, infinity), rec)) {
+                    // The ray leaves the scene and picks up the background colour.
+                    radiance += throughput * context.background;
+                    if (depth == 0 && features) *features = surfaceFeatures{context.background, vec3(0, 0, 0), 0, nullptr, 0};
+                    break;
+                }
+            }
+
+            // Textures are filtered over the cone's footprint, so distant surfaces read coarse mip levels.
+            coneWidth += context.pixelSpread * rec.t * current.direction().length();
+            rec.footprint = coneWidth * rec.uvDensity;
+
+            const material* mat = (*context.materials)[rec.mat];
+            auto emission = mat->emitted(rec.u, rec.v, rec.p);
+            if (context.lights && scatterPdf > 0 && !emission.nearZero()) {
+                // The last vertex's shadow ray could have found this light too.
+                auto lightPdf = context.lights->pdfValue(current.origin(), current.direction());
+                emission = (scatterPdf / (scatterPdf + lightPdf)) * emission;
+            }
+            radiance += throughput * emission;
+
+            ray scattered;
+            colour attenuation;
+            bool scatters = mat->scatter(current, rec, attenuation, scattered);
+
+            if (depth == 0 && features) {
+                // Camera rays are never weighted, so emission is what the first surface emits.
+                auto albedo = scatters ? attenuation : colour(std::fmin(emission.x(), 1.0), std::fmin(emission.y(), 1.0), std::fmin(emission.z(), 1.0));
+                *features = surfaceFeatures{albedo, rec.normal, rec.t * current.direction().length(), rec.object, rec.mat};
+            }
+            if (!scatters) break;
+
+            scatterPdf = mat->scatteringPdf(current, rec, scattered);
+            if (context.lights && scatterPdf > 0 && depth + 1 < context.maxDepth) {
+                radiance += throughput * attenuation * directLight(current, rec, *mat, context);
+            }
+
+            throughput = throughput * attenuation;
+
+            // Roulette only pays off when another bounce follows; a path at maxDepth ends without spending a random number.
+            if (depth + 1 >= context.rouletteDepth && depth + 1 < context.maxDepth) {
+                auto survival = std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z()));
+                if (survival < 1) {
+                    if (randomDouble() >= survival) {
+                        countStat(statRouletteKills);
+                        break;
+                    }
+                    throughput = throughput / survival;
+                }
+            }
+
+            // Start the next ray just off the surface, on the side it leaves towards, so it cannot hit that surface again.
+            current = ray(offsetRayOrigin(rec.p, rec.normal, scattered.direction()), scattered.direction(), scattered.time());
+        }
+
+        // A path that reaches maxDepth gathers no more light.
+        return radiance;
+    }
+
+  private:
+    colour directLight(const ray& rIn, const hitRecord& rec, const material& mat, const renderContext& context) const {
+        // Light from one direction towards the lights, weighted against the material's chance of scattering that way. The
+        // caller scales it by the attenuation.
+        auto direction = context.lights->random(rec.p);
+        auto lightPdf = context.lights->pdfValue(rec.p, direction);
+        if (!(lightPdf > 0)) return colour(0, 0, 0);
+
+        ray shadow(offsetRayOrigin(rec.p, rec.normal, direction), direction, rIn.time());
+        auto scatterPdf = mat.scatteringPdf(rIn, rec, shadow);
+        if (scatterPdf <= 0) return colour(0, 0, 0);
+
+        threadRayCount()++;
+        countStat(statShadowRays);
+
+        // Whatever the shadow ray reaches first is what lights the vertex; a miss finds the background, which only scattered
+        // rays count.
+        hitRecord lightRec;
+        if (!context.world->hit(shadow, interval(0.001, infinity), lightRec)) return colour(0, 0, 0);
+
+        auto emission = (*context.materials)[lightRec.mat]->emitted(lightRec.u, lightRec.v, lightRec.p);
+
+        // (attenuation * scatterPdf * emission / lightPdf) times the weight lightPdf / (lightPdf + scatterPdf).
+        return (scatterPdf / (lightPdf + scatterPdf)) * emission;
+    }
+};
+
+#endif
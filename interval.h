@@ -3,56 +3,61 @@
 
 #include "rayTracer.h"
 
-class interval {
+template <typename T>
+class intervalT {
     public:
-        double min, max;
+        T min, max;
 
         // Fegault interval is empty. 
-        interval() : min(+infinity), max(-infinity) {}
+        intervalT() : min(T(+infinity)), max(T(-infinity)) {}
 
-        interval(double min, double max) : min(min), max(max) {}
+        intervalT(T min, T max) : min(min), max(max) {}
 
-        interval(const interval& a, const interval& b) {
+        intervalT(const intervalT& a, const intervalT& b) {
             // Create the interval tightly enclosing the two input intervals.
             min = a.min <= b.min ? a.min : b.min;
             max = a.max >= b.max ? a.max : b.max;
         }
 
-        double size() const {
+        T size() const {
             return max - min;
         }
 
-        bool contains(double x) const {
+        bool contains(T x) const {
             return min <= x && x <= max;
         }
 
-        bool surrounds(double x) const {
+        bool surrounds(T x) const {
             return min < x && x < max;
         }
 
-        double clamp(double x) const {
+        T clamp(T x) const {
             if (x < min) return min;
             if (x > max) return max;
             return x;
         }
 
-        interval expand(double delta) const {
+        intervalT expand(T delta) const {
             auto padding = delta / 2;
-            return interval(min - padding, max + padding);
+            return intervalT(min - padding, max + padding);
         }
 
-        static const interval empty, universe;
-};
+        static const intervalT empty, universe;
+
+        friend intervalT operator+(const intervalT& ival, T displacement) {
+            return intervalT(ival.min + displacement, ival.max + displacement);
+        }
 
-const interval interval::empty = interval(+infinity, -infinity);
-const interval interval::universe = interval(-infinity, +infinity);
+        friend intervalT operator+(T displacement, const intervalT& ival) {
+            return ival + displacement;
+        }
+};
 
-interval operator+(const interval& ival, double displacement) {
-    return interval(ival.min + displacement, ival.max + displacement);
-}
+template <typename T>
+const intervalT<T> intervalT<T>::empty = intervalT<T>(T(+infinity), T(-infinity));
+template <typename T>
+const intervalT<T> intervalT<T>::universe = intervalT<T>(T(-infinity), T(+infinity));
 
-interval operator+(double displacement, const interval& ival) {
-    return ival + displacement;
-}
+using interval = intervalT<real>;
 
 #endif
\ No newline at end of file
@@ -2,21 +2,142 @@
 #define MATERIAL_H
 
 #include "rayTracer.h"
+#include "hittable.h"
 #include "texture.h"
-
-class hitRecord;
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 class material {
     public:
         virtual ~material() = default;
 
-        virtual colour emitted(double u, double v, const point3& p) const {
+        virtual colour emitted(real u, real v, const point3& p) const {
             return colour(0,0,0);
         }
 
         virtual bool scatter(const ray& rIn, const hitRecord& rec, colour& attenuation, ray& scattered) const {
             return false;
         }
+
+        virtual real scatteringPdf(const ray& rIn, const hitRecord& rec, const ray& scattered) const {
+            // Solid-angle density with which scatter() picks scattered's direction. A material that returns one must pick
+            // directions in proportion to how much light it scatters that way, so attenuation times this density is its
+            // response to light from any direction; the integrator then samples lights directly at its surfaces. The default
+            // of 0 is for specular and non-scattering materials.
+            return 0;
+        }
+};
+
+class materialRegistry {
+    /*
+    * Owns every material in the scene and names each by a 32-bit handle. Primitives and hit
+    * records carry handles instead of shared_ptrs, so a hit never touches a reference count and
+    * render threads never contend for one. A material added twice keeps its first handle.
+    *
+    * Each scene owns a registry, so its materials go when the scene does (see materialScope).
+    * Every handle carries its registry's tag, so a primitive made for one registry and rendered
+    * with another is caught at its first lookup instead of reading some other material. Tags
+    * repeat after 255 registries, so the check is very likely, not certain, to catch a mix-up.
+    */
+  public:
+    static const int indexBits = 24;
+
+    materialRegistry() : tag(nextTag()) {}
+
+    materialRegistry(const materialRegistry&) = delete;
+    materialRegistry& operator=(const materialRegistry&) = delete;
+
+    materialHandle add(shared_ptr<material> mat) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = handles.find(mat.get());
+        if (found != handles.end()) return found->second;
+
+        if (materials.size() >= (size_t(1) << indexBits)) {
+            std::cerr << "ERROR: A scene cannot have more than " << (1 << indexBits) << " materials.\n";
+            std::abort();
+        }
+        auto handle = tag << indexBits | materialHandle(materials.size());
+        materials.push_back(mat);
+        handles.emplace(mat.get(), handle);
+        return handle;
+    }
+
+    const material* operator[](materialHandle handle) const {
+        if (!owns(handle)) wrongRegistry(handle);
+        return materials[indexOf(handle)].get();
+    }
+
+    bool owns(materialHandle handle) const {
+        return handle >> indexBits == tag && indexOf(handle) < materials.size();
+    }
+
+    static uint32_t indexOf(materialHandle handle) {
+        // The material's position in its registry, counting from 0: a small, stable number for AOVs.
+        return handle & ((1u << indexBits) - 1);
+    }
+
+    size_t size() const {
+        return materials.size();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        materials.clear();
+        handles.clear();
+    }
+
+  private:
+    materialHandle tag;
+    std::vector<shared_ptr<material>> materials;
+    std::unordered_map<const material*, materialHandle> handles;
+    std::mutex mutex;
+
+    static materialHandle nextTag() {
+        // 1 to 255 in turn.
+        static std::atomic<uint32_t> count(0);
+        return count++ % 255 + 1;
+    }
+
+    [[noreturn]] void wrongRegistry(materialHandle handle) const {
+        std::cerr << "ERROR: Material handle " << handle << " does not belong to the registry being rendered with (tag " << tag
+                  << ", " << materials.size() << " materials). Build primitives inside the scene's materialScope.\n";
+        std::abort();
+    }
+};
+
+inline materialRegistry*& activeMaterials(void) {
+    // Per thread, so scenes built on different threads at once each add to their own registry.
+    static thread_local materialRegistry* active = nullptr;
+    return active;
+}
+
+inline materialRegistry& sceneMaterials(void) {
+    // The registry that primitives add their materials to when they are made: the one of the scene being built, or a
+    // process-wide one for primitives made outside any scene.
+    static materialRegistry unscoped;
+    auto active = activeMaterials();
+    return active ? *active : unscoped;
+}
+
+class materialScope {
+    // Makes a registry the one sceneMaterials() returns for as long as the scope lives, e.g. while a scene is being built.
+  public:
+    materialScope(materialRegistry& registry) : previous(activeMaterials()) {
+        activeMaterials() = &registry;
+    }
+
+    materialScope(const materialScope&) = delete;
+    materialScope& operator=(const materialScope&) = delete;
+
+    ~materialScope() {
+        activeMaterials() = previous;
+    }
+
+  private:
+    materialRegistry* previous;
 };
 
 class lambertian : public material {
@@ -34,18 +155,24 @@ class lambertian : public material {
         if (scatterDirection.nearZero()) scatterDirection = rec.normal;
 
         scattered = ray(rec.p, scatterDirection, rIn.time());
-        attenuation = tex->value(rec.u, rec.v, rec.p);
+        attenuation = tex->filteredValue(rec.u, rec.v, rec.p, rec.footprint);
         return true;
     }
+
+    real scatteringPdf(const ray& rIn, const hitRecord& rec, const ray& scattered) const override {
+        // normal + randomUnitVector() is cosine distributed about the normal.
+        auto cosine = dot(rec.normal, unitVector(scattered.direction()));
+        return cosine < 0 ? 0 : cosine / pi;
+    }
 };
 
 class metal : public material {
     private:
         colour albedo;
-        double fuzz;
+        real fuzz;
 
     public: 
-        metal(const colour& albedo, double fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
+        metal(const colour& albedo, real fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
 
         bool scatter(const ray& rIn, const hitRecord& rec, colour& attenuation, ray& scattered) const override {
             vec3 reflected = reflect(rIn.direction(), rec.normal);
@@ -59,24 +186,24 @@ class metal : public material {
 class dielectric : public material {
     private: 
         // Refractive index in vacuum or air, or the ratio of the material's refractive index over the refractive index of the enclosing media. 
-        double refractionIndex;
+        real refractionIndex;
 
-        static double reflectance(double cosine, double refractionIndex) {
+        static real reflectance(real cosine, real refractionIndex) {
             auto r0 = (1 - refractionIndex) / (1 + refractionIndex);
             r0 = r0 * r0;
             return r0 + (1 - r0) * pow((1 - cosine), 5);
         }
     
     public: 
-        dielectric(double refractionIndex) : refractionIndex(refractionIndex) {}
+        dielectric(real refractionIndex) : refractionIndex(refractionIndex) {}
 
         bool scatter(const ray& rIn, const hitRecord& rec, colour& attenuation, ray& scattered) const override {
             attenuation = colour(1.0, 1.0, 1.0);
-            double ri = rec.frontFace ? (1.0 / refractionIndex) : refractionIndex;
+            real ri = rec.frontFace ? (1.0 / refractionIndex) : refractionIndex;
 
             vec3 unitDirection = unitVector(rIn.direction());
-            double cosTheta = fmin(dot(-unitDirection, rec.normal), 1.0);
-            double sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+            real cosTheta = std::fmin(dot(-unitDirection, rec.normal), real(1));
+            real sinTheta = sqrt(1 - cosTheta * cosTheta);
 
             bool cannotRefract = ri * sinTheta > 1.0;
             vec3 direction;
@@ -97,7 +224,7 @@ class diffuseLight : public material {
     diffuseLight(shared_ptr<texture> tex) : tex(tex) {}
     diffuseLight(const colour& emit) : tex(make_shared<solidColour>(emit)) {}
 
-    colour emitted(double u, double v, const point3& p) const override {
+    colour emitted(real u, real v, const point3& p) const override {
         return tex->value(u, v, p);
     }
 
@@ -113,10 +240,14 @@ class isotropic : public material {
     bool scatter(const ray& rIn, const hitRecord& rec, colour& attenuation, ray& scattered)
     const override {
         scattered = ray(rec.p, randomUnitVector(), rIn.time());
-        attenuation = tex->value(rec.u, rec.v, rec.p);
+        attenuation = tex->filteredValue(rec.u, rec.v, rec.p, rec.footprint);
         return true;
     }
 
+    real scatteringPdf(const ray& rIn, const hitRecord& rec, const ray& scattered) const override {
+        return 1 / (4 * pi);
+    }
+
   private:
     shared_ptr<texture> tex;
 };
@@ -0,0 +1,564 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "rayTracer.h"
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+class mappedFile {
+    // A read-only memory mapping of a whole file, unmapped when destroyed.
+  public:
+    mappedFile(const std::string& filename) {
+        #ifdef _WIN32
+            file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE) return;
+            LARGE_INTEGER fileSize;
+            if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!mapping) return;
+            auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (!view) return;
+            bytes = static_cast<const unsigned char*>(view);
+            byteCount = size_t(fileSize.QuadPart);
+        #else
+            int descriptor = open(filename.c_str(), O_RDONLY);
+            if (descriptor < 0) return;
+            struct stat status;
+            if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+                auto view = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+                if (view != MAP_FAILED) {
+                    bytes = static_cast<const unsigned char*>(view);
+                    byteCount = size_t(status.st_size);
+                }
+            }
+            close(descriptor);  // The mapping stays valid after the descriptor is closed.
+        #endif
+    }
+
+    mappedFile(const mappedFile&) = delete;
+    mappedFile& operator=(const mappedFile&) = delete;
+
+    ~mappedFile() {
+        #ifdef _WIN32
+            if (bytes) UnmapViewOfFile(bytes);
+            if (mapping) CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        #else
+            if (bytes) munmap(const_cast<unsigned char*>(bytes), byteCount);
+        #endif
+    }
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return byteCount; }
+
+  private:
+    const unsigned char* bytes = nullptr;
+    size_t byteCount = 0;
+    #ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+    #endif
+};
+
+class meshData {
+    /*
+    * The vertex and index buffers of a triangle mesh, shared by every triangleMesh that uses them.
+    *
+    * Vertices are single-precision: three floats of position per vertex, and optionally three of
+    * normal and two of texture coordinates. Each triangle is three vertex indices. The buffers
+    * either live in vectors owned by the mesh, or point straight into a memory-mapped binary mesh
+    * file, so a large mesh loads without being parsed or copied.
+    */
+  public:
+    uint32_t vertexCount = 0;
+    uint32_t triangleCount = 0;
+    const float* positions = nullptr;
+    const float* normals = nullptr;     // Null if the mesh has no vertex normals.
+    const float* uvs = nullptr;         // Null if the mesh has no texture coordinates.
+    const uint32_t* indices = nullptr;
+
+    static shared_ptr<meshData> fromBuffers(std::vector<float> positions, std::vector<uint32_t> indices,
+                                            std::vector<float> normals = {}, std::vector<float> uvs = {}) {
+        // Take ownership of buffers built in memory. normals and uvs may be empty.
+        auto mesh = make_shared<meshData>();
+        mesh->ownedPositions = std::move(positions);
+        mesh->ownedIndices = std::move(indices);
+        mesh->ownedNormals = std::move(normals);
+        mesh->ownedUvs = std::move(uvs);
+
+        mesh->vertexCount = uint32_t(mesh->ownedPositions.size() / 3);
+        mesh->triangleCount = uint32_t(mesh->ownedIndices.size() / 3);
+        mesh->positions = mesh->ownedPositions.data();
+        mesh->indices = mesh->ownedIndices.data();
+        mesh->normals = mesh->ownedNormals.size() == mesh->ownedPositions.size() ? mesh->ownedNormals.data() : nullptr;
+        mesh->uvs = mesh->ownedUvs.size() / 2 == mesh->vertexCount && mesh->vertexCount > 0 ? mesh->ownedUvs.data() : nullptr;
+        return mesh;
+    }
+
+    static shared_ptr<meshData> fromMapping(shared_ptr<mappedFile> file, uint32_t vertexCount, uint32_t triangleCount,
+                                            size_t positionsOffset, size_t normalsOffset, size_t uvsOffset, size_t indicesOffset) {
+        // Use buffers inside a mapped file. An offset of zero means the buffer is absent.
+        auto mesh = make_shared<meshData>();
+        mesh->mapping = file;
+        mesh->vertexCount = vertexCount;
+        mesh->triangleCount = triangleCount;
+        mesh->positions = reinterpret_cast<const float*>(file->data() + positionsOffset);
+        mesh->normals = normalsOffset ? reinterpret_cast<const float*>(file->data() + normalsOffset) : nullptr;
+        mesh->uvs = uvsOffset ? reinterpret_cast<const float*>(file->data() + uvsOffset) : nullptr;
+        mesh->indices = reinterpret_cast<const uint32_t*>(file->data() + indicesOffset);
+        return mesh;
+    }
+
+    point3 position(uint32_t vertex) const {
+        const float* p = positions + 3 * size_t(vertex);
+        return point3(p[0], p[1], p[2]);
+    }
+
+    bool validIndices() const {
+        for (size_t i = 0; i < 3 * size_t(triangleCount); i++) {
+            if (indices[i] >= vertexCount) return false;
+        }
+        return true;
+    }
+
+  private:
+    std::vector<float> ownedPositions, ownedNormals, ownedUvs;
+    std::vector<uint32_t> ownedIndices;
+    shared_ptr<mappedFile> mapping;
+};
+
+class triangleMesh : public hittable {
+    /*
+    * A triangle mesh with its own BVH over its triangles.
+    *
+    * Triangles are not separate hittables: the BVH leaves refer to triangle indices in the shared
+    * buffers, so a triangle costs its 12 bytes of indices plus a 4-byte slot in the leaf order.
+    * Rays are tested with the watertight algorithm of Woop, Benthin and Wald (2013), so a ray
+    * through an edge or vertex shared by several triangles always hits at least one of them.
+    */
+  public:
+    triangleMesh(shared_ptr<const meshData> data, shared_ptr<material> mat, const bvhBuildSettings& settings = bvhBuildSettings())
+      : data(data), mat(sceneMaterials().add(mat))
+    {
+        std::vector<aabb> triangleBounds(data->triangleCount);
+        threadPool pool(settings.threadCount);
+        bvhBuilder::parallelChunks(pool, triangleBounds.size(), [&](size_t first, size_t last) {
+            for (size_t t = first; t < last; t++) {
+                const uint32_t* v = data->indices + 3 * t;
+                triangleBounds[t] = aabb(aabb(data->position(v[0]), data->position(v[1])), aabb(data->position(v[0]), data->position(v[2])));
+            }
+        });
+
+        bvhBuilder builder(settings);
+        builder.build(triangleBounds);
+        nodes = std::move(builder.nodes);
+        triangleOrder = std::move(builder.primitiveOrder);
+
+        bBox = aabb::empty;
+        for (const auto& box : triangleBounds) bBox = aabb(bBox, box);
+
+        std::clog << "Mesh: " << data->triangleCount << " triangles, " << data->vertexCount << " vertices, BVH of " << nodes.size()
+                  << " nodes built in " << 1000 * builder.buildSeconds << " ms.\n";
+    }
+
+    bool intersect(const ray& r, interval rayT, hitRecord& rec) const override {
+        // Shear the ray once so that it points along +z; every triangle test then works in that frame.
+        watertightRay wr(r);
+        uint32_t closestTriangle = 0;
+        double closestB1 = 0, closestB2 = 0;
+
+        bool hitAnything = traverseBvh(nodes, r, rayT, [&](const linearBvhNode& leaf, interval& leafT) {
+            bool hitLeaf = false;
+            for (uint32_t i = 0; i < leaf.primitiveCount; i++) {
+                auto triangle = triangleOrder[leaf.offset + i];
+                double t, b1, b2;
+                if (hitTriangle(wr, triangle, leafT, t, b1, b2)) {
+                    hitLeaf = true;
+                    leafT.max = t;
+                    closestTriangle = triangle;
+                    closestB1 = b1;
+                    closestB2 = b2;
+                }
+            }
+            return hitLeaf;
+        });
+        if (!hitAnything) return false;
+
+        // Keep the triangle and its barycentrics; completeHit() turns them into the surface.
+        rec.t = rayT.max;
+        rec.object = this;
+        rec.primitive = closestTriangle;
+        rec.u = closestB1;
+        rec.v = closestB2;
+        return true;
+    }
+
+    void completeHit(const ray& r, hitRecord& rec) const override {
+        const uint32_t* v = data->indices + 3 * size_t(rec.primitive);
+        auto p0 = data->position(v[0]);
+        auto geometricNormal = unitVector(cross(data->position(v[1]) - p0, data->position(v[2]) - p0));
+        double b1 = rec.u, b2 = rec.v;
+        auto b0 = 1 - b1 - b2;
+
+        rec.p = r.at(rec.t);
+        rec.mat = mat;
+        rec.frontFace = dot(r.direction(), geometricNormal) < 0;
+
+        vec3 shadingNormal = geometricNormal;
+        if (data->normals) {
+            shadingNormal = unitVector(b0 * vertexVector(data->normals, v[0]) + b1 * vertexVector(data->normals, v[1])
+                                     + b2 * vertexVector(data->normals, v[2]));
+        }
+        rec.normal = rec.frontFace ? shadingNormal : -shadingNormal;
+
+        if (data->uvs) {
+            const float* uv0 = data->uvs + 2 * size_t(v[0]);
+            const float* uv1 = data->uvs + 2 * size_t(v[1]);
+            const float* uv2 = data->uvs + 2 * size_t(v[2]);
+            rec.u = b0 * uv0[0] + b1 * uv1[0] + b2 * uv2[0];
+            rec.v = b0 * uv0[1] + b1 * uv1[1] + b2 * uv2[1];
+
+            // The ratio of the triangle's uv area to its surface area.
+            auto uvArea = fabs((uv1[0] - uv0[0]) * (uv2[1] - uv0[1]) - (uv2[0] - uv0[0]) * (uv1[1] - uv0[1]));
+            auto area = cross(data->position(v[1]) - p0, data->position(v[2]) - p0).length();
+            rec.uvDensity = area > 0 ? sqrt(uvArea / area) : 0;
+        } else {
+            rec.uvDensity = 0;
+        }
+    }
+
+    aabb boundingBox() const override {
+        return bBox;
+    }
+
+  private:
+    shared_ptr<const meshData> data;
+    materialHandle mat;
+    std::vector<linearBvhNode> nodes;
+    std::vector<uint32_t> triangleOrder;   // Triangle index of each leaf slot.
+    aabb bBox;
+
+    struct watertightRay {
+        point3 origin;
+        int kx, ky, kz;         // Axes permuted so kz is the direction's largest component.
+        double sx, sy, sz;      // Shear that maps the direction onto +z.
+
+        watertightRay(const ray& r) : origin(r.origin()) {
+            const vec3& d = r.direction();
+            kz = fabs(d.x()) > fabs(d.y()) ? (fabs(d.x()) > fabs(d.z()) ? 0 : 2) : (fabs(d.y()) > fabs(d.z()) ? 1 : 2);
+            kx = (kz + 1) % 3;
+            ky = (kx + 1) % 3;
+            if (d[kz] < 0) std::swap(kx, ky);   // Keep the winding, and so the signs of the edge functions, unchanged.
+
+            sx = d[kx] / d[kz];
+            sy = d[ky] / d[kz];
+            sz = 1.0 / d[kz];
+        }
+    };
+
+    bool hitTriangle(const watertightRay& wr, uint32_t triangle, interval rayT, double& t, double& b1, double& b2) const {
+        countStat(statTriangleTests);
+        const uint32_t* v = data->indices + 3 * size_t(triangle);
+        auto a = data->position(v[0]) - wr.origin;
+        auto b = data->position(v[1]) - wr.origin;
+        auto c = data->position(v[2]) - wr.origin;
+
+        // Vertices in the sheared frame, where the ray runs along +z from the origin.
+        auto ax = a[wr.kx] - wr.sx * a[wr.kz], ay = a[wr.ky] - wr.sy * a[wr.kz];
+        auto bx = b[wr.kx] - wr.sx * b[wr.kz], by = b[wr.ky] - wr.sy * b[wr.kz];
+        auto cx = c[wr.kx] - wr.sx * c[wr.kz], cy = c[wr.ky] - wr.sy * c[wr.kz];
+
+        // Scaled barycentrics from the 2D edge functions. Both triangles that share an edge compute exactly the same value
+        // for it, with opposite signs, so a ray through the edge can never slip between them.
+        auto u = cx * by - cy * bx;
+        auto w0 = ax * cy - ay * cx;
+        auto w1 = bx * ay - by * ax;
+        if ((u < 0 || w0 < 0 || w1 < 0) && (u > 0 || w0 > 0 || w1 > 0)) return false;
+
+        auto determinant = u + w0 + w1;
+        if (determinant == 0) return false;
+
+        auto scaledT = u * (wr.sz * a[wr.kz]) + w0 * (wr.sz * b[wr.kz]) + w1 * (wr.sz * c[wr.kz]);
+        t = scaledT / determinant;
+        if (!rayT.surrounds(t)) return false;
+
+        b1 = w0 / determinant;
+        b2 = w1 / determinant;
+        countStat(statTriangleHits);
+        return true;
+    }
+
+    static vec3 vertexVector(const float* buffer, uint32_t vertex) {
+        const float* p = buffer + 3 * size_t(vertex);
+        return vec3(p[0], p[1], p[2]);
+    }
+};
+
+// Binary mesh files (.rtmesh): a 32-byte header, then the positions, normals and texture coordinates as little-endian floats and
+// the indices as little-endian 32-bit integers, each buffer starting on a 4-byte boundary. The file is mapped and used in place.
+struct binaryMeshHeader {
+    char magic[8];          // "RTMESH1" and a terminating zero.
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+    uint32_t flags;         // meshHasNormals | meshHasUvs.
+    uint32_t reserved[3];
+};
+
+static_assert(sizeof(binaryMeshHeader) == 32, "The binary mesh header is 32 bytes.");
+
+const uint32_t meshHasNormals = 1;
+const uint32_t meshHasUvs = 2;
+const char binaryMeshMagic[8] = "RTMESH1";
+
+inline bool hostIsLittleEndian(void) {
+    const uint16_t endianTest = 1;
+    return *reinterpret_cast<const unsigned char*>(&endianTest) == 1;
+}
+
+inline bool saveBinaryMesh(const meshData& mesh, const std::string& filename) {
+    // Write a mesh in the binary format, e.g. after loading an OBJ once. Returns false if the file cannot be written.
+    if (!hostIsLittleEndian()) {
+        std::cerr << "ERROR: Binary meshes can only be written on little-endian machines.\n";
+        return false;
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "ERROR: Could not open mesh file '" << filename << "' for writing.\n";
+        return false;
+    }
+
+    binaryMeshHeader header = {};
+    std::memcpy(header.magic, binaryMeshMagic, sizeof(header.magic));
+    header.vertexCount = mesh.vertexCount;
+    header.triangleCount = mesh.triangleCount;
+    header.flags = (mesh.normals ? meshHasNormals : 0) | (mesh.uvs ? meshHasUvs : 0);
+
+    auto vertices = size_t(mesh.vertexCount);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(mesh.positions), std::streamsize(3 * vertices * sizeof(float)));
+    if (mesh.normals) file.write(reinterpret_cast<const char*>(mesh.normals), std::streamsize(3 * vertices * sizeof(float)));
+    if (mesh.uvs) file.write(reinterpret_cast<const char*>(mesh.uvs), std::streamsize(2 * vertices * sizeof(float)));
+    file.write(reinterpret_cast<const char*>(mesh.indices), std::streamsize(3 * size_t(mesh.triangleCount) * sizeof(uint32_t)));
+    return bool(file);
+}
+
+inline shared_ptr<meshData> loadBinaryMesh(const std::string& filename) {
+    // Map a binary mesh file. Returns null if it cannot be read or is not a valid mesh.
+    auto file = make_shared<mappedFile>(filename);
+    if (!file->data()) {
+        std::cerr << "ERROR: Could not open mesh file '" << filename << "'.\n";
+        return nullptr;
+    }
+
+    binaryMeshHeader header;
+    if (file->size() < sizeof(header) || !hostIsLittleEndian()) {
+        std::cerr << "ERROR: '" << filename << "' is not a binary mesh this machine can read.\n";
+        return nullptr;
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+
+    auto vertices = size_t(header.vertexCount);
+    size_t offset = sizeof(header);
+    size_t positionsOffset = offset;
+    offset += 3 * vertices * sizeof(float);
+    size_t normalsOffset = (header.flags & meshHasNormals) ? offset : 0;
+    if (normalsOffset) offset += 3 * vertices * sizeof(float);
+    size_t uvsOffset = (header.flags & meshHasUvs) ? offset : 0;
+    if (uvsOffset) offset += 2 * vertices * sizeof(float);
+    size_t indicesOffset = offset;
+    offset += 3 * size_t(header.triangleCount) * sizeof(uint32_t);
+
+    if (std::memcmp(header.magic, binaryMeshMagic, sizeof(header.magic)) != 0 || offset > file->size()) {
+        std::cerr << "ERROR: '" << filename << "' is not a valid binary mesh.\n";
+        return nullptr;
+    }
+
+    auto mesh = meshData::fromMapping(file, header.vertexCount, header.triangleCount, positionsOffset, normalsOffset, uvsOffset, indicesOffset);
+    if (!mesh->validIndices()) {
+        std::cerr << "ERROR: '" << filename << "' has vertex indices out of range.\n";
+        return nullptr;
+    }
+    return mesh;
+}
+
+inline shared_ptr<meshData> loadObj(const std::string& filename) {
+    /*
+    * Load the triangles of a Wavefront OBJ file: v, vt and vn lines and polygonal f lines, which are
+    * split into triangle fans. Other lines (groups, materials, ...) are ignored. OBJ indexes
+    * positions, texture coordinates and normals separately, so each distinct combination becomes
+    * one shared vertex. Normals and texture coordinates are kept only if every face vertex has them.
+    */
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "ERROR: Could not open mesh file '" << filename << "'.\n";
+        return nullptr;
+    }
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::vector<float> objPositions, objUvs, objNormals;
+
+    struct vertexKey {
+        int position, uv, normal;
+        bool operator==(const vertexKey& other) const {
+            return position == other.position && uv == other.uv && normal == other.normal;
+        }
+    };
+    struct vertexKeyHash {
+        size_t operator()(const vertexKey& key) const {
+            return size_t(mixBits(uint64_t(uint32_t(key.position)) | uint64_t(uint32_t(key.uv)) << 32) ^ uint64_t(uint32_t(key.normal)));
+        }
+    };
+    std::unordered_map<vertexKey, uint32_t, vertexKeyHash> vertexIndex;
+    std::vector<vertexKey> vertices;
+    std::vector<uint32_t> indices;
+    bool allUvs = true, allNormals = true;
+
+    const char* cursor = text.c_str();
+    const char* end = cursor + text.size();
+    auto skipSpaces = [&]() { while (cursor < end && (*cursor == ' ' || *cursor == '\t')) cursor++; };
+    auto readFloats = [&](std::vector<float>& out, int count) {
+        // Read count numbers from the current line. Missing ones (e.g. a one-component vt) read as zero.
+        for (int i = 0; i < count; i++) {
+            skipSpaces();
+            char* next;
+            float value = std::strtof(cursor, &next);
+            bool onLine = next != cursor && cursor < end && *cursor != '\n' && *cursor != '\r';
+            out.push_back(onLine ? value : 0.0f);
+            if (onLine) cursor = next;
+        }
+    };
+    auto resolve = [](long index, size_t count) {
+        // OBJ indices start at 1; negative ones count back from the latest element. Returns -1 for a missing or bad index.
+        long resolved = index > 0 ? index - 1 : long(count) + index;
+        return (index == 0 || resolved < 0 || resolved >= long(count)) ? -1 : int(resolved);
+    };
+
+    int lineNumber = 0;
+    while (cursor < end) {
+        lineNumber++;
+        skipSpaces();
+
+        if (cursor[0] == 'v' && (cursor[1] == ' ' || cursor[1] == '\t')) {
+            cursor++;
+            readFloats(objPositions, 3);
+        } else if (cursor[0] == 'v' && cursor[1] == 't') {
+            cursor += 2;
+            readFloats(objUvs, 2);
+        } else if (cursor[0] == 'v' && cursor[1] == 'n') {
+            cursor += 2;
+            readFloats(objNormals, 3);
+        } else if (cursor[0] == 'f' && (cursor[1] == ' ' || cursor[1] == '\t')) {
+            cursor++;
+            uint32_t face[3];
+            int corners = 0;
+            while (true) {
+                skipSpaces();
+                if (cursor >= end || *cursor == '\n' || *cursor == '\r' || *cursor == '#') break;
+
+                char* next;
+                vertexKey key = { resolve(std::strtol(cursor, &next, 10), objPositions.size() / 3), -1, -1 };
+                if (next == cursor || key.position < 0) {
+                    std::cerr << "ERROR: Bad face on line " << lineNumber << " of '" << filename << "'.\n";
+                    return nullptr;
+                }
+                cursor = next;
+                if (*cursor == '/') {
+                    cursor++;
+                    if (*cursor != '/') {
+                        key.uv = resolve(std::strtol(cursor, &next, 10), objUvs.size() / 2);
+                        cursor = next;
+                    }
+                    if (*cursor == '/') {
+                        cursor++;
+                        key.normal = resolve(std::strtol(cursor, &next, 10), objNormals.size() / 3);
+                        cursor = next;
+                    }
+                }
+                allUvs = allUvs && key.uv >= 0;
+                allNormals = allNormals && key.normal >= 0;
+
+                auto found = vertexIndex.emplace(key, uint32_t(vertices.size()));
+                if (found.second) vertices.push_back(key);
+                auto corner = found.first->second;
+
+                // Fan triangulation: corners 0, k-1, k.
+                if (corners < 2) {
+                    face[corners] = corner;
+                } else {
+                    indices.insert(indices.end(), { face[0], face[1], corner });
+                    face[1] = corner;
+                }
+                corners++;
+            }
+        }
+
+        // Move on to the next line.
+        while (cursor < end && *cursor != '\n') cursor++;
+        cursor++;
+    }
+
+    std::vector<float> positions, normals, uvs;
+    positions.reserve(3 * vertices.size());
+    for (const auto& key : vertices) {
+        positions.insert(positions.end(), objPositions.begin() + 3 * key.position, objPositions.begin() + 3 * key.position + 3);
+        if (allNormals) normals.insert(normals.end(), objNormals.begin() + 3 * key.normal, objNormals.begin() + 3 * key.normal + 3);
+        if (allUvs) uvs.insert(uvs.end(), objUvs.begin() + 2 * key.uv, objUvs.begin() + 2 * key.uv + 2);
+    }
+
+    return meshData::fromBuffers(std::move(positions), std::move(indices), std::move(normals), std::move(uvs));
+}
+
+inline shared_ptr<meshData> torusMesh(real majorRadius, real minorRadius, int rings, int sides) {
+    // A torus about the y axis with normals and texture coordinates, for scenes and tests that need a mesh without a file. The
+    // seam's vertices are repeated with u or v of 1, at exactly the first ones' positions, so the surface stays closed.
+    std::vector<float> positions, normals, uvs;
+    std::vector<uint32_t> indices;
+    for (int i = 0; i <= rings; i++) {
+        auto phi = 2 * pi * (i % rings) / rings;
+        for (int j = 0; j <= sides; j++) {
+            auto theta = 2 * pi * (j % sides) / sides;
+            vec3 normal(cos(theta) * cos(phi), sin(theta), cos(theta) * sin(phi));
+            auto p = vec3(majorRadius * cos(phi), 0, majorRadius * sin(phi)) + minorRadius * normal;
+            positions.insert(positions.end(), {float(p.x()), float(p.y()), float(p.z())});
+            normals.insert(normals.end(), {float(normal.x()), float(normal.y()), float(normal.z())});
+            uvs.insert(uvs.end(), {float(i) / rings, float(j) / sides});
+        }
+    }
+
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < sides; j++) {
+            auto a = uint32_t(i * (sides + 1) + j), b = uint32_t((i + 1) * (sides + 1) + j);
+            indices.insert(indices.end(), {a, a + 1, b, a + 1, b + 1, b});
+        }
+    }
+    return meshData::fromBuffers(std::move(positions), std::move(indices), std::move(normals), std::move(uvs));
+}
+
+inline shared_ptr<meshData> loadMesh(const std::string& filename) {
+    // Load a .rtmesh binary mesh or an OBJ file, by extension.
+    auto dot = filename.rfind('.');
+    if (dot != std::string::npos && filename.substr(dot) == ".rtmesh") return loadBinaryMesh(filename);
+    return loadObj(filename);
+}
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include "rayTracer.h"
+#include "rtw_stb_image.h"
+#include <cstdint>
+#include <vector>
+
+class mipmap {
+    /*
+    * An image and its chain of half-size levels, down to 1x1, in one 8-bit RGBX buffer.
+    *
+    * Every level is stored in 8x8 texel tiles of 256 bytes (four cache lines), so texels that
+    * are close in the image are close in memory whichever direction a lookup moves. Level 0 holds
+    * the image's own bytes and each further level averages 2x2 texels of the one before.
+    *
+    * A lookup picks its level from its footprint, so a texture seen from far away reads a small
+    * level that stays in cache rather than scattering reads over the whole image.
+    */
+  public:
+    mipmap() {}
+
+    mipmap(const rtwImage& image) {
+        if (image.width() <= 0 || image.height() <= 0) return;
+
+        // Level 0 is the image itself; each later level halves the size of the one before, rounding down, until 1x1.
+        int levelWidth = image.width(), levelHeight = image.height();
+        size_t offset = 0;
+        while (true) {
+            level next;
+            next.width = levelWidth;
+            next.height = levelHeight;
+            next.tilesX = (levelWidth + tileSize - 1) / tileSize;
+            next.offset = offset;
+            offset += size_t(next.tilesX) * ((levelHeight + tileSize - 1) / tileSize) * tileBytes;
+            levels.push_back(next);
+
+            if (levelWidth == 1 && levelHeight == 1) break;
+            levelWidth = levelWidth > 1 ? levelWidth / 2 : 1;
+            levelHeight = levelHeight > 1 ? levelHeight / 2 : 1;
+        }
+        texels.assign(offset, 0);
+
+        for (int y = 0; y < image.height(); y++) {
+            for (int x = 0; x < image.width(); x++) {
+                auto pixel = image.pixelData(x, y);
+                uint8_t* texel = texelAddress(levels[0], x, y);
+                texel[0] = pixel[0];
+                texel[1] = pixel[1];
+                texel[2] = pixel[2];
+            }
+        }
+
+        for (size_t l = 1; l < levels.size(); l++) downsample(levels[l - 1], levels[l]);
+    }
+
+    bool empty() const {
+        return levels.empty();
+    }
+
+    int levelCount() const {
+        return int(levels.size());
+    }
+
+    int levelFor(real footprint) const {
+        // The level whose texels are about as wide as a footprint of `footprint` uv units, or narrower. A footprint narrower
+        // than one texel of level 0 (including 0) uses level 0.
+        const level& base = levels[0];
+        auto texelFootprint = footprint * std::sqrt(double(base.width) * base.height);
+        if (!(texelFootprint >= 2)) return 0;
+
+        int l = std::ilogb(texelFootprint);
+        return l < levelCount() - 1 ? l : levelCount() - 1;
+    }
+
+    colour lookup(int levelIndex, real u, real v) const {
+        // Nearest texel of the level at (u, v), both in [0, 1] with v = 0 at the top row.
+        const level& lv = levels[levelIndex];
+        auto x = clamp(int(u * lv.width), lv.width);
+        auto y = clamp(int(v * lv.height), lv.height);
+        const uint8_t* texel = texelAddress(lv, x, y);
+
+        auto colourScale = 1.0 / 255.0;
+        return colour(colourScale * texel[0], colourScale * texel[1], colourScale * texel[2]);
+    }
+
+  private:
+    static const int tileSize = 8;
+    static const int bytesPerTexel = 4;     // R, G, B and one unused byte, so a tile row is 32 bytes.
+    static const size_t tileBytes = tileSize * tileSize * bytesPerTexel;
+
+    struct level {
+        int width, height;
+        int tilesX;         // Tiles per row of tiles.
+        size_t offset;      // Byte offset of the level's first tile.
+    };
+
+    std::vector<level> levels;
+    std::vector<uint8_t> texels;
+
+    static int clamp(int x, int size) {
+        if (x < 0) return 0;
+        return x < size ? x : size - 1;
+    }
+
+    size_t texelOffset(const level& lv, int x, int y) const {
+        auto tile = size_t(y / tileSize) * lv.tilesX + size_t(x / tileSize);
+        return lv.offset + tile * tileBytes + size_t((y % tileSize) * tileSize + x % tileSize) * bytesPerTexel;
+    }
+
+    uint8_t* texelAddress(const level& lv, int x, int y) {
+        return texels.data() + texelOffset(lv, x, y);
+    }
+
+    const uint8_t* texelAddress(const level& lv, int x, int y) const {
+        return texels.data() + texelOffset(lv, x, y);
+    }
+
+    void downsample(const level& source, const level& target) {
+        // Box filter: each target texel averages the 2x2 source texels it covers, reusing the last row or column of an
+        // odd-sized source.
+        for (int y = 0; y < target.height; y++) {
+            for (int x = 0; x < target.width; x++) {
+                int x0 = clamp(2 * x, source.width), x1 = clamp(2 * x + 1, source.width);
+                int y0 = clamp(2 * y, source.height), y1 = clamp(2 * y + 1, source.height);
+                const uint8_t* corners[4] = {
+                    texelAddress(source, x0, y0), texelAddress(source, x1, y0),
+                    texelAddress(source, x0, y1), texelAddress(source, x1, y1)
+                };
+
+                uint8_t* texel = texelAddress(target, x, y);
+                for (int c = 0; c < 3; c++) {
+                    int sum = corners[0][c] + corners[1][c] + corners[2][c] + corners[3][c];
+                    texel[c] = uint8_t((sum + 2) / 4);
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -2,82 +2,133 @@
 #define PERLIN_H
 
 #include "rayTracer.h"
+#include "aabb.h"
+#include "simd.h"
+#include "threadPool.h"
+#include <vector>
 
 class perlin {
-    public: 
+    /*
+    * Perlin noise over a 256^3 lattice of random unit gradients.
+    *
+    * turbulance() needs one noise value per octave, and the octaves do not depend on each other,
+    * so they are evaluated side by side: four per AVX register, or two per SSE2 register. Each
+    * lane runs exactly the scalar arithmetic in the scalar order, so the SIMD and scalar paths
+    * return identical values.
+    */
+    public:
         perlin() {
-            randVector = new vec3[pointCount];
             for (int i = 0; i < pointCount; i++) {
-                randVector[i] = unitVector(vec3::random(-1, 1));
+                auto gradient = unitVector(vec3::random(-1, 1));
+                gradientX[i] = gradient.x();
+                gradientY[i] = gradient.y();
+                gradientZ[i] = gradient.z();
             }
 
-            permX = perlinGeneratePerm();
-            permY = perlinGeneratePerm();
-            permZ = perlinGeneratePerm();
-        }
-
-        ~perlin() {
-            delete[] randVector;
-            delete[] permX;
-            delete[] permY;
-            delete[] permZ;
+            perlinGeneratePerm(permX);
+            perlinGeneratePerm(permY);
+            perlinGeneratePerm(permZ);
         }
 
         double noise(const point3& p) const {
-            auto u = p.x() - floor(p.x());
-            auto v = p.y() - floor(p.y());
-            auto w = p.z() - floor(p.z());
-
-            auto i = int(floor(p.x()));
-            auto j = int(floor(p.y()));
-            auto k = int(floor(p.z()));
-            vec3 c[2][2][2];
-
-            for (int di = 0; di < 2; di++) {
-                for (int dj = 0; dj < 2; dj++) {
-                    for (int dk = 0; dk < 2; dk++) {
-                        c[di][dj][dk] = randVector[
-                            permX[(i+di) & 255] ^
-                            permY[(j+dj) & 255] ^
-                            permZ[(k+dk) & 255]
-                        ];
-                    }
-                }
-            }
-            return perlinInterpolation(c, u, v, w);
+            return cellNoise(latticePoint(p));
         }
 
         double turbulance(const point3& p, int depth) const {
+            // The octaves' noise values are found a batch at a time; their weighted sum is still taken in octave order.
             auto accum = 0.0;
             auto temporaryP = p;
             auto weight = 1.0;
 
-            for (int i = 0; i < depth; i++) {
-                accum += weight * noise(temporaryP);
-                weight *= 0.5;
-                temporaryP *= 2;
+            for (int first = 0; first < depth; first += batchSize) {
+                int count = depth - first < batchSize ? depth - first : batchSize;
+                double octaves[batchSize];
+                noiseOctaves(temporaryP, count, octaves);
+
+                for (int l = 0; l < count; l++) {
+                    accum += weight * octaves[l];
+                    weight *= 0.5;
+                    temporaryP *= 2;
+                }
             }
 
             return fabs(accum);
         }
 
-    private: 
+    private:
         static const int pointCount = 256;
-        vec3* randVector;
-        int* permX;
-        int* permY;
-        int* permZ;
+        static const int batchSize = 4;
+        double gradientX[pointCount];
+        double gradientY[pointCount];
+        double gradientZ[pointCount];
+        int permX[pointCount];
+        int permY[pointCount];
+        int permZ[pointCount];
+
+        struct latticePoint {
+            // The lattice cell containing a point, and the point's position within it.
+            int i, j, k;
+            double u, v, w;
+
+            latticePoint(const point3& p)
+              : i(int(floor(p.x()))), j(int(floor(p.y()))), k(int(floor(p.z()))),
+                u(p.x() - floor(p.x())), v(p.y() - floor(p.y())), w(p.z() - floor(p.z())) {}
+        };
+
+        int gradientIndex(const latticePoint& cell, int di, int dj, int dk) const {
+            return permX[(cell.i + di) & 255] ^ permY[(cell.j + dj) & 255] ^ permZ[(cell.k + dk) & 255];
+        }
 
-        static int* perlinGeneratePerm(void) {
-            auto p = new int[pointCount];
+        double cellNoise(const latticePoint& cell) const {
+            auto uu = hermite(cell.u);
+            auto vv = hermite(cell.v);
+            auto ww = hermite(cell.w);
+            auto accum = 0.0;
 
+            for (int di = 0; di < 2; di++) {
+                for (int dj = 0; dj < 2; dj++) {
+                    for (int dk = 0; dk < 2; dk++) {
+                        auto g = gradientIndex(cell, di, dj, dk);
+                        auto blend = (di ? uu : 1 - uu) * (dj ? vv : 1 - vv) * (dk ? ww : 1 - ww);
+                        accum += blend * (gradientX[g] * (cell.u - di) + gradientY[g] * (cell.v - dj) + gradientZ[g] * (cell.w - dk));
+                    }
+                }
+            }
+            return accum;
+        }
+
+        static double hermite(double t) {
+            return t * t * (3 - 2 * t);
+        }
+
+        void noiseOctaves(const point3& p, int count, double out[]) const {
+            // out[l] = noise(2^l * p) for l < count <= batchSize.
+            #ifdef RAYTRACER_X86
+                static const bool hasAvx = cpuSupportsAvx();
+                if (hasAvx) {
+                    noiseAvx(p, count, out);
+                    return;
+                }
+                auto q = p;
+                for (int l = 0; l < count; l += 2) {
+                    noiseSse(q, count - l, out + l);
+                    q *= 4;
+                }
+            #else
+                auto q = p;
+                for (int l = 0; l < count; l++) {
+                    out[l] = noise(q);
+                    q *= 2;
+                }
+            #endif
+        }
+
+        static void perlinGeneratePerm(int* p) {
             for (int i = 0; i < pointCount; i++) {
                 p[i] = i;
             }
 
             permute(p, pointCount);
-
-            return p;
         }
 
         static void permute(int* p, int n) {
@@ -89,24 +140,196 @@ class perlin {
             }
         }
 
-        static double perlinInterpolation(const vec3 c[2][2][2], double u, double v, double w) {
-            auto uu = u * u * (3 - 2 * u);
-            auto vv = v * v * (3 - 2 * v);
-            auto ww = w * w * (3 - 2 * w);
-            auto accum = 0.0;
+    #ifdef RAYTRACER_X86
+        void noiseSse(const point3& p, int count, double out[]) const {
+            // SSE2: noise at p and 2p, one per lane. SSE2 has no floor, so each lane truncates and steps down if that rounded up.
+            __m128d one = _mm_set1_pd(1.0);
+            __m128d scale = _mm_set_pd(2.0, 1.0);
+            __m128d offset[3];
+            int hash[3][2][2];      // hash[axis][corner][lane]: the permutation entries of the cell's two lattice planes.
+            const int* perms[3] = { permX, permY, permZ };
+
+            for (int a = 0; a < 3; a++) {
+                __m128d x = _mm_mul_pd(_mm_set1_pd(double(p[a])), scale);
+                __m128i truncated = _mm_cvttpd_epi32(x);
+                __m128d floorX = _mm_cvtepi32_pd(truncated);
+                floorX = _mm_sub_pd(floorX, _mm_and_pd(_mm_cmpgt_pd(floorX, x), one));
+                offset[a] = _mm_sub_pd(x, floorX);
+
+                int cell[4];
+                _mm_storeu_si128((__m128i*)cell, _mm_cvttpd_epi32(floorX));
+                for (int l = 0; l < 2; l++) {
+                    hash[a][0][l] = perms[a][cell[l] & 255];
+                    hash[a][1][l] = perms[a][(cell[l] + 1) & 255];
+                }
+            }
+
+            __m128d u = offset[0], v = offset[1], w = offset[2];
+            __m128d uu = hermiteSse(u), vv = hermiteSse(v), ww = hermiteSse(w);
+            __m128d accum = _mm_setzero_pd();
+
+            for (int di = 0; di < 2; di++) {
+                __m128d bu = di ? uu : _mm_sub_pd(one, uu);
+                __m128d du = di ? _mm_sub_pd(u, one) : u;
+                for (int dj = 0; dj < 2; dj++) {
+                    __m128d bv = dj ? vv : _mm_sub_pd(one, vv);
+                    __m128d dv = dj ? _mm_sub_pd(v, one) : v;
+                    for (int dk = 0; dk < 2; dk++) {
+                        __m128d bw = dk ? ww : _mm_sub_pd(one, ww);
+                        __m128d dw = dk ? _mm_sub_pd(w, one) : w;
+                        int g0 = hash[0][di][0] ^ hash[1][dj][0] ^ hash[2][dk][0];
+                        int g1 = hash[0][di][1] ^ hash[1][dj][1] ^ hash[2][dk][1];
 
-            for (int i = 0; i < 2; i++)
-                for (int j = 0; j < 2; j++)
-                    for (int k = 0; k < 2; k++) {
-                        vec3 weightV(u - i, v - j, w - k);
-                        accum += (i * uu + (1 - i)*(1 - uu))
-                            * (j * vv + (1 - j) * (1 - vv))
-                            * (k * ww + (1 - k) * (1 - ww))
-                            * dot(c[i][j][k], weightV);
+                        __m128d dot = _mm_add_pd(_mm_add_pd(
+                            _mm_mul_pd(_mm_set_pd(gradientX[g1], gradientX[g0]), du),
+                            _mm_mul_pd(_mm_set_pd(gradientY[g1], gradientY[g0]), dv)),
+                            _mm_mul_pd(_mm_set_pd(gradientZ[g1], gradientZ[g0]), dw));
+                        __m128d blend = _mm_mul_pd(_mm_mul_pd(bu, bv), bw);
+                        accum = _mm_add_pd(accum, _mm_mul_pd(blend, dot));
                     }
+                }
+            }
 
-            return accum;
+            double lanes[2];
+            _mm_storeu_pd(lanes, accum);
+            out[0] = lanes[0];
+            if (count > 1) out[1] = lanes[1];
         }
+
+        static __m128d hermiteSse(__m128d t) {
+            return _mm_mul_pd(_mm_mul_pd(t, t), _mm_sub_pd(_mm_set1_pd(3.0), _mm_mul_pd(_mm_set1_pd(2.0), t)));
+        }
+
+        RAYTRACER_TARGET_AVX
+        void noiseAvx(const point3& p, int count, double out[]) const {
+            // AVX: noise at p, 2p, 4p and 8p, one per lane. Lanes past count are computed and dropped.
+            __m256d one = _mm256_set1_pd(1.0);
+            __m256d scale = _mm256_set_pd(8.0, 4.0, 2.0, 1.0);
+            __m256d offset[3];
+            int hash[3][2][4];      // hash[axis][corner][lane]: the permutation entries of the cell's two lattice planes.
+            const int* perms[3] = { permX, permY, permZ };
+
+            for (int a = 0; a < 3; a++) {
+                __m256d x = _mm256_mul_pd(_mm256_set1_pd(double(p[a])), scale);
+                __m256d floorX = _mm256_floor_pd(x);
+                offset[a] = _mm256_sub_pd(x, floorX);
+
+                int cell[4];
+                _mm_storeu_si128((__m128i*)cell, _mm256_cvttpd_epi32(floorX));
+                for (int l = 0; l < 4; l++) {
+                    hash[a][0][l] = perms[a][cell[l] & 255];
+                    hash[a][1][l] = perms[a][(cell[l] + 1) & 255];
+                }
+            }
+
+            __m256d u = offset[0], v = offset[1], w = offset[2];
+            __m256d three = _mm256_set1_pd(3.0), two = _mm256_set1_pd(2.0);
+            __m256d uu = _mm256_mul_pd(_mm256_mul_pd(u, u), _mm256_sub_pd(three, _mm256_mul_pd(two, u)));
+            __m256d vv = _mm256_mul_pd(_mm256_mul_pd(v, v), _mm256_sub_pd(three, _mm256_mul_pd(two, v)));
+            __m256d ww = _mm256_mul_pd(_mm256_mul_pd(w, w), _mm256_sub_pd(three, _mm256_mul_pd(two, w)));
+            __m256d accum = _mm256_setzero_pd();
+
+            for (int di = 0; di < 2; di++) {
+                __m256d bu = di ? uu : _mm256_sub_pd(one, uu);
+                __m256d du = di ? _mm256_sub_pd(u, one) : u;
+                for (int dj = 0; dj < 2; dj++) {
+                    __m256d bv = dj ? vv : _mm256_sub_pd(one, vv);
+                    __m256d dv = dj ? _mm256_sub_pd(v, one) : v;
+                    for (int dk = 0; dk < 2; dk++) {
+                        __m256d bw = dk ? ww : _mm256_sub_pd(one, ww);
+                        __m256d dw = dk ? _mm256_sub_pd(w, one) : w;
+                        int g[4];
+                        for (int l = 0; l < 4; l++) g[l] = hash[0][di][l] ^ hash[1][dj][l] ^ hash[2][dk][l];
+
+                        __m256d dot = _mm256_add_pd(_mm256_add_pd(
+                            _mm256_mul_pd(_mm256_set_pd(gradientX[g[3]], gradientX[g[2]], gradientX[g[1]], gradientX[g[0]]), du),
+                            _mm256_mul_pd(_mm256_set_pd(gradientY[g[3]], gradientY[g[2]], gradientY[g[1]], gradientY[g[0]]), dv)),
+                            _mm256_mul_pd(_mm256_set_pd(gradientZ[g[3]], gradientZ[g[2]], gradientZ[g[1]], gradientZ[g[0]]), dw));
+                        __m256d blend = _mm256_mul_pd(_mm256_mul_pd(bu, bv), bw);
+                        accum = _mm256_add_pd(accum, _mm256_mul_pd(blend, dot));
+                    }
+                }
+            }
+
+            double lanes[4];
+            _mm256_storeu_pd(lanes, accum);
+            for (int l = 0; l < count; l++) out[l] = lanes[l];
+        }
+    #endif
+};
+
+class turbulenceGrid {
+    /*
+    * Turbulence sampled once on a regular grid over a box, then read back with trilinear
+    * interpolation: eight loads instead of seven octaves of noise. The grid smooths away detail
+    * finer than its spacing, so it suits static textures seen from a distance. Points outside
+    * the box are not covered; callers evaluate those directly.
+    */
+  public:
+    turbulenceGrid() {}
+
+    turbulenceGrid(const perlin& noise, const aabb& region, int gridResolution, int depth, int threadCount = 0)
+      : region(region), resolution(gridResolution < 2 ? 2 : gridResolution)
+    {
+        values.resize(size_t(resolution) * resolution * resolution);
+
+        // One z slice per task, on threadCount threads (0 for the threadPool default).
+        threadPool pool(threadCount);
+        pool.parallelFor(resolution, [&](int k) {
+            for (int j = 0; j < resolution; j++) {
+                for (int i = 0; i < resolution; i++) {
+                    values[index(i, j, k)] = float(noise.turbulance(gridPoint(i, j, k), depth));
+                }
+            }
+        });
+    }
+
+    bool empty() const {
+        return values.empty();
+    }
+
+    bool contains(const point3& p) const {
+        return region.x.contains(p.x()) && region.y.contains(p.y()) && region.z.contains(p.z());
+    }
+
+    double value(const point3& p) const {
+        // Trilinear interpolation between the eight grid points around p, which must lie inside the region.
+        int cell[3];
+        double f[3];
+        for (int a = 0; a < 3; a++) {
+            const interval& ax = region.axisInterval(a);
+            auto x = ax.size() > 0 ? (p[a] - ax.min) / ax.size() * (resolution - 1) : 0.0;
+            cell[a] = int(x);
+            if (cell[a] > resolution - 2) cell[a] = resolution - 2;
+            if (cell[a] < 0) cell[a] = 0;
+            f[a] = x - cell[a];
+        }
+
+        auto accum = 0.0;
+        for (int di = 0; di < 2; di++) {
+            for (int dj = 0; dj < 2; dj++) {
+                for (int dk = 0; dk < 2; dk++) {
+                    auto weight = (di ? f[0] : 1 - f[0]) * (dj ? f[1] : 1 - f[1]) * (dk ? f[2] : 1 - f[2]);
+                    accum += weight * values[index(cell[0] + di, cell[1] + dj, cell[2] + dk)];
+                }
+            }
+        }
+        return accum;
+    }
+
+  private:
+    aabb region;
+    int resolution = 0;
+    std::vector<float> values;
+
+    size_t index(int i, int j, int k) const {
+        return (size_t(k) * resolution + j) * resolution + i;
+    }
+
+    point3 gridPoint(int i, int j, int k) const {
+        auto step = [this](const interval& ax, int n) { return ax.min + ax.size() * n / (resolution - 1); };
+        return point3(step(region.x, i), step(region.y, j), step(region.z, k));
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -4,14 +4,17 @@
 #include "rayTracer.h"
 #include "hittable.h"
 #include "hittableList.h"
+#include "material.h"
 
 class quad : public hittable {
     public: 
-        quad(const point3& Q, const vec3& u, const vec3& v, shared_ptr<material> material) : Q(Q), u(u), v(v), mat(material) {
+        quad(const point3& Q, const vec3& u, const vec3& v, shared_ptr<material> material) : Q(Q), u(u), v(v), mat(sceneMaterials().add(material)) {
             auto n = cross(u, v);
             normal = unitVector(n);
             D = dot(normal, Q);
             w = n / dot(n, n);
+            area = n.length();
+            uvDensity = area > 0 ? 1 / sqrt(area) : 0;
             
             setBoundingBox();
         }
@@ -27,34 +30,44 @@ class quad : public hittable {
             return bBox;
         }
 
-        bool hit(const ray& r, interval rayT, hitRecord& rec) const override {
-            auto denom = dot(normal, r.direction());
-
-            // No hit if the ray is parallel to the plane. 
-            if (fabs(denom) < 1e-8) return false;
-
-            // Return false if the hit point parameter t is outside of the ray interval. 
-            auto t = (D - dot(normal, r.origin())) / denom;
-            if (!rayT.contains(t)) return false;
+        bool intersect(const ray& r, interval rayT, hitRecord& rec) const override {
+            countStat(statQuadTests);
+            real t;
+            if (!planeHit(r, rayT, t, rec)) return false;
 
-            // Determine the hit point lies within the planar shape using its plane coordinates. 
-            auto intersection = r.at(t);
-            vec3 planarHitpointVector = intersection - Q;
-            auto alpha = dot(w, cross(planarHitpointVector, v));
-            auto beta = dot(w, cross(u, planarHitpointVector));
+            // Ray hits the 2D shape. isInterior() has set the UV coordinates; completeHit() sets the rest.
+            rec.t = t;
+            rec.object = this;
 
-            if (!isInterior(alpha, beta, rec)) return false;
+            countStat(statQuadHits);
+            return true;
+        }
 
-            // Ray hits the 2D shape. Set the rest of the hit record and return true;
-            rec.t = t;
-            rec.p = intersection;
+        void completeHit(const ray& r, hitRecord& rec) const override {
+            rec.p = r.at(rec.t);
             rec.mat = mat;
+            rec.uvDensity = uvDensity;
             rec.setFaceNormal(r, normal);
+        }
 
-            return true;
+        real pdfValue(const point3& origin, const vec3& direction) const override {
+            // random() picks points uniformly by area; an area element dA seen at distance d and angle theta covers a solid
+            // angle of dA cos(theta) / d^2. The lookup is not a ray test, so it leaves the tracing statistics alone.
+            hitRecord rec;
+            real t;
+            if (!planeHit(ray(origin, direction, 0), interval(0.001, infinity), t, rec)) return 0;
+
+            auto distanceSquared = t * t * direction.lengthSquared();
+            auto cosine = fabs(dot(direction, normal)) / direction.length();
+            return distanceSquared / (cosine * area);
         }
 
-        virtual bool isInterior(double a, double b, hitRecord& rec) const {
+        vec3 random(const point3& origin) const override {
+            auto p = Q + (randomDouble() * u) + (randomDouble() * v);
+            return p - origin;
+        }
+
+        virtual bool isInterior(real a, real b, hitRecord& rec) const {
             interval unitInterval = interval(0, 1);
 
             // Given the hit point in plane coordinates, return false if it is outside the primitive, otherwise set the hit record UV coordinates and return true. 
@@ -68,14 +81,36 @@ class quad : public hittable {
         }
 
     private:
+        bool planeHit(const ray& r, interval rayT, real& t, hitRecord& rec) const {
+            // Where r meets the shape within rayT, without counting a test. isInterior() sets the hit record's UV coordinates.
+            auto denom = dot(normal, r.direction());
+
+            // No hit if the ray is parallel to the plane. 
+            if (fabs(denom) < 1e-8) return false;
+
+            // Return false if the hit point parameter t is outside of the ray interval. 
+            t = (D - dot(normal, r.origin())) / denom;
+            if (!rayT.contains(t)) return false;
+
+            // Determine the hit point lies within the planar shape using its plane coordinates. 
+            auto intersection = r.at(t);
+            vec3 planarHitpointVector = intersection - Q;
+            auto alpha = dot(w, cross(planarHitpointVector, v));
+            auto beta = dot(w, cross(u, planarHitpointVector));
+
+            return isInterior(alpha, beta, rec);
+        }
+
         point3 Q;
         vec3 u;
         vec3 v;
         vec3 w;
-        shared_ptr<material> mat;
+        materialHandle mat;
         aabb bBox;
         vec3 normal;
-        double D;
+        real D;
+        real area;
+        real uvDensity;     // The unit uv square covers the quad's area |u x v|.
 };
 
 inline shared_ptr<hittableList> box(const point3& a, const point3& b, shared_ptr<material> mat) {
@@ -3,34 +3,77 @@
 
 #include "vec3.h"
 
-class ray {
+#include <cstring>
+
+template <typename T>
+class rayT {
     private: 
-        point3 orig;
-        vec3 dir;
-        double tm;
+        vec3T<T> orig;
+        vec3T<T> dir;
+        T tm;
 
     public: 
-        ray() {}
+        rayT() : tm(0) {}
 
-        ray(const point3& origin, const vec3& direction) : orig(origin), dir(direction) {}
+        rayT(const vec3T<T>& origin, const vec3T<T>& direction) : orig(origin), dir(direction), tm(0) {}
         
-        ray(const point3& origin, const vec3& direction, double time) : orig(origin), dir(direction), tm(time) {}
+        rayT(const vec3T<T>& origin, const vec3T<T>& direction, T time) : orig(origin), dir(direction), tm(time) {}
 
-        const point3& origin() const {
+        const vec3T<T>& origin() const {
             return orig;
         }
 
-        const vec3& direction() const {
+        const vec3T<T>& direction() const {
             return dir;
         }
 
-        double time() const {
+        T time() const {
             return tm;
         }
 
-        point3 at(double t) const {
+        vec3T<T> at(T t) const {
             return orig + t * dir;
         }
 };
 
-#endif
\ No newline at end of file
+using ray = rayT<real>;
+
+inline float offsetFloat(float value, int ulps) {
+    // Move value by a whole number of units in the last place, towards +infinity for positive ulps. Must not cross zero.
+    int32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    bits += value < 0 ? -ulps : ulps;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline double offsetFloat(double value, int ulps) {
+    int64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    bits += value < 0 ? -ulps : ulps;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline point3 offsetRayOrigin(const point3& p, const vec3& normal, const vec3& direction) {
+    /*
+    * Start a ray leaving a surface at p just off the surface, on the side `direction` goes to, so it cannot hit the surface it
+    * leaves (Waechter and Binder, "A Fast and Robust Method for Avoiding Self-Intersection", Ray Tracing Gems, 2019).
+    *
+    * The offset is a whole number of ULPs along the normal, so it scales with the magnitude of p and works in single and
+    * double precision alike. Near the origin, where ULPs get tiny, a small fixed offset is used instead.
+    */
+    const real origin = real(1) / 32;
+    const real floatScale = real(1) / 65536;
+    const real intScale = 256;
+
+    auto n = dot(normal, direction) < 0 ? -normal : normal;
+    point3 offset;
+    for (int a = 0; a < 3; a++) {
+        auto ulps = int(intScale * n[a]);
+        offset[a] = fabs(p[a]) < origin ? p[a] + floatScale * n[a] : offsetFloat(p[a], ulps);
+    }
+    return offset;
+}
+
+#endif
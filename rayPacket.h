@@ -0,0 +1,148 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "rayTracer.h"
+#include "simd.h"
+
+// Ray distances narrowed to float for the box tests, moved one rounding step outwards so the tests only ever grow. Meant for
+// distances, which are never within a few ulps of float's smallest normal number.
+inline float roundDownToFloat(real value) {
+    auto f = float(value);
+    return f - std::fabs(f) * std::numeric_limits<float>::epsilon();
+}
+
+inline float roundUpToFloat(real value) {
+    auto f = float(value);
+    return f + std::fabs(f) * std::numeric_limits<float>::epsilon();
+}
+
+inline float originRoundingError(real origin, float invDirection) {
+    // Bound on how far rounding an origin coordinate to float moves its slab distances along the ray. The float box tests
+    // widen each slab by it, as the relative rounding of their arithmetic is covered by scaling the far distance. Rounding
+    // moves the coordinate by at most half an ulp, and this allows a whole one. Single-precision builds have exact origins.
+    #ifdef RAYTRACER_FLOAT
+        (void)origin;
+        (void)invDirection;
+        return 0;
+    #else
+        auto error = std::fabs(float(origin)) * std::numeric_limits<float>::epsilon() * std::fabs(invDirection);
+        return error == error ? error : 0;  // An origin at 0 on an axis the ray is parallel to gives 0 * infinity.
+    #endif
+}
+
+class rayPacket {
+    /*
+    * A bundle of up to `size` coherent rays (e.g. the camera rays of neighbouring pixels) traced
+    * through the scene together.
+    *
+    * Origins and inverse directions are also kept as single-precision structure-of-arrays, so a box
+    * is tested against four lanes per SSE instruction. Each lane keeps its own closest hit distance
+    * and its own random state, so a lane's result does not depend on the rest of the packet.
+    */
+  public:
+    static const int size = 8;
+
+    ray rays[size];
+    int count = 0;
+
+    alignas(16) float originX[size], originY[size], originZ[size];
+    alignas(16) float invDirX[size], invDirY[size], invDirZ[size];
+    alignas(16) float originErrX[size], originErrY[size], originErrZ[size];    // See originRoundingError().
+    alignas(16) float boxTMax[size];    // tMax rounded up to float, for the box tests.
+    real tMin = 0;
+    real tMax[size];                  // Closest hit so far in each lane.
+    bool hit[size];                     // Whether each lane has hit anything yet.
+    randomState random[size];           // Each lane's random sequence, swapped in around its primitive tests.
+
+    void add(const ray& r) {
+        // Append a ray as the next lane. Call prepare() once every lane is added.
+        rays[count++] = r;
+    }
+
+    void prepare(interval rayT) {
+        tMin = rayT.min;
+        for (int k = 0; k < size; k++) {
+            // Unused lanes get a copy of lane 0, so the SIMD loops never read uninitialised data.
+            const ray& r = rays[k < count ? k : 0];
+            originX[k] = float(r.origin().x());
+            originY[k] = float(r.origin().y());
+            originZ[k] = float(r.origin().z());
+            invDirX[k] = float(1.0 / r.direction().x());
+            invDirY[k] = float(1.0 / r.direction().y());
+            invDirZ[k] = float(1.0 / r.direction().z());
+            originErrX[k] = originRoundingError(r.origin().x(), invDirX[k]);
+            originErrY[k] = originRoundingError(r.origin().y(), invDirY[k]);
+            originErrZ[k] = originRoundingError(r.origin().z(), invDirZ[k]);
+            hit[k] = false;
+            setTMax(k, rayT.max);
+        }
+    }
+
+    void recordHit(int k, real t) {
+        hit[k] = true;
+        setTMax(k, t);
+    }
+
+    int activeMask() const {
+        return (1 << count) - 1;
+    }
+
+    int hitBox(const float boundsMin[3], const float boundsMax[3], int mask) const {
+        // Slab test of one box against every lane in `mask`. Returns the mask of lanes whose rays hit the box. Like the wide
+        // BVH, the far distance is scaled up slightly and each slab widened by the lane's origin rounding error, so float
+        // rounding never rejects a box that a lane really hits.
+        int result = 0;
+        const float tMinF = roundDownToFloat(tMin);
+
+        #ifdef RAYTRACER_X86
+            const __m128 farScale = _mm_set1_ps(1.0f + 6.0f * std::numeric_limits<float>::epsilon());
+            for (int k = 0; k < size; k += 4) {
+                __m128 t0 = _mm_set1_ps(tMinF);
+                __m128 t1 = _mm_load_ps(boxTMax + k);
+                slab(boundsMin[0], boundsMax[0], _mm_load_ps(originX + k), _mm_load_ps(invDirX + k), _mm_load_ps(originErrX + k), farScale, t0, t1);
+                slab(boundsMin[1], boundsMax[1], _mm_load_ps(originY + k), _mm_load_ps(invDirY + k), _mm_load_ps(originErrY + k), farScale, t0, t1);
+                slab(boundsMin[2], boundsMax[2], _mm_load_ps(originZ + k), _mm_load_ps(invDirZ + k), _mm_load_ps(originErrZ + k), farScale, t0, t1);
+                result |= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << k;
+            }
+        #else
+            const float farScale = 1.0f + 6.0f * std::numeric_limits<float>::epsilon();
+            const float* origins[3] = { originX, originY, originZ };
+            const float* invDirs[3] = { invDirX, invDirY, invDirZ };
+            const float* originErrs[3] = { originErrX, originErrY, originErrZ };
+            for (int k = 0; k < size; k++) {
+                float t0 = tMinF, t1 = boxTMax[k];
+                for (int a = 0; a < 3; a++) {
+                    float tA = (boundsMin[a] - origins[a][k]) * invDirs[a][k];
+                    float tB = (boundsMax[a] - origins[a][k]) * invDirs[a][k];
+                    float tLow = (tA < tB ? tA : tB) - originErrs[a][k];
+                    float tHigh = (tA < tB ? tB : tA) * farScale + originErrs[a][k];
+                    if (tLow > t0) t0 = tLow;
+                    if (tHigh < t1) t1 = tHigh;
+                }
+                result |= int(t0 <= t1) << k;
+            }
+        #endif
+
+        return result & mask;
+    }
+
+  private:
+    void setTMax(int k, real t) {
+        tMax[k] = t;
+        boxTMax[k] = roundUpToFloat(t);
+    }
+
+    #ifdef RAYTRACER_X86
+    static void slab(float boundMin, float boundMax, __m128 origin, __m128 invDirection, __m128 originError, __m128 farScale,
+                     __m128& t0, __m128& t1) {
+        // Clip four lanes' [t0, t1] against one axis. max/min return their second operand when the first is NaN, so NaN slabs
+        // (from 0 * infinity, or infinity - infinity) leave the interval unchanged.
+        __m128 tA = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boundMin), origin), invDirection);
+        __m128 tB = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boundMax), origin), invDirection);
+        t0 = _mm_max_ps(_mm_sub_ps(_mm_min_ps(tA, tB), originError), t0);
+        t1 = _mm_min_ps(_mm_add_ps(_mm_mul_ps(_mm_max_ps(tA, tB), farScale), originError), t1);
+    }
+    #endif
+};
+
+#endif
@@ -2,11 +2,11 @@
 #define RAYTRACER_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <limits>
 #include <memory>
-//#include <random>
 
 // C++ std usings. 
 using std::fabs;
@@ -14,6 +14,14 @@ using std::make_shared;
 using std::shared_ptr;
 using std::sqrt;
 
+// Scalar type of geometry and ray traversal. Build with RAYTRACER_FLOAT (cmake -DRAYTRACER_FLOAT=ON) to use single precision,
+// which halves the size of vectors, rays and primitives. Pixel sums stay in double either way.
+#ifdef RAYTRACER_FLOAT
+    using real = float;
+#else
+    using real = double;
+#endif
+
 // Constants. 
 const double infinity = std::numeric_limits<double>::infinity();
 const double pi = 3.1415926535897932385;
@@ -23,18 +31,43 @@ inline double degreesToRadians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+// Counter-based random numbers. Every random value is a hash of a per-sample key and a running dimension counter, so a sample's
+// numbers depend only on (pixel, sample, dimension) and never on the thread or the order in which pixels are rendered. 
+struct randomState {
+    uint64_t key = 0;
+    uint64_t dimension = 0;
+};
+
+inline randomState& threadRandomState(void) {
+    // Each thread owns its state, so render threads never share (or lock) a generator. 
+    thread_local randomState state;
+    return state;
+}
+
+inline uint64_t mixBits(uint64_t v) {
+    // SplitMix64 finaliser: a fast bijective hash with full avalanche. 
+    v ^= v >> 30;
+    v *= 0xbf58476d1ce4e5b9ULL;
+    v ^= v >> 27;
+    v *= 0x94d049bb133111ebULL;
+    v ^= v >> 31;
+    return v;
+}
+
+inline void seedRandom(uint64_t pixel, uint64_t sample, uint64_t dimension = 0) {
+    // Restarts the calling thread's random sequence at the given dimension of sample `sample` of pixel `pixel`. 
+    auto& state = threadRandomState();
+    state.key = mixBits(mixBits(pixel + 0x9e3779b97f4a7c15ULL) ^ (sample * 0xd1b54a32d192ed03ULL));
+    state.dimension = dimension;
+}
+
 inline double randomDouble(void) {
     // Returns a random real in [0, 1). 
-    return rand() / (RAND_MAX + 1.0);
+    auto& state = threadRandomState();
+    uint64_t bits = mixBits(state.key ^ (state.dimension++ * 0x9e3779b97f4a7c15ULL));
+    return (bits >> 11) * (1.0 / 9007199254740992.0);
 }
 
-// The same as randomDouble() but using the random include. 
-// inline double randomDouble(void) {
-//     static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-//     static std::mt19937 generator;
-//     return distribution(generator);
-// }
-
 inline double randomDouble(double min, double max) {
     // Returns a random real in [min, max).
     return min + (max - min) * randomDouble();
@@ -42,13 +75,14 @@ inline double randomDouble(double min, double max) {
 
 inline int randomInt(int min, int max) {
     // Returns a random integer in [min, max].
-    return int(randomDouble(min, max++));
+    return int(randomDouble(min, max + 1));
 }
 
 // Common headers. 
 #include "colour.h"
 #include "interval.h"
 #include "ray.h"
+#include "stats.h"
 #include "vec3.h"
 
 #endif
\ No newline at end of file
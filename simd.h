@@ -0,0 +1,36 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Instruction set detection shared by the SIMD code paths. SSE2 is always available on x86-64; wider instruction sets are
+// compiled with per-function target attributes and picked at runtime, so one binary runs on every x86 CPU.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define RAYTRACER_X86 1
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define RAYTRACER_TARGET_AVX __attribute__((target("avx")))
+#else
+    #define RAYTRACER_TARGET_AVX
+#endif
+
+inline bool cpuSupportsAvx(void) {
+    // True if both the CPU and the operating system support AVX, so 8-wide box tests can run.
+    #if !defined(RAYTRACER_X86)
+        return false;
+    #elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        bool osSaves = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        return osSaves && avx && (_xgetbv(0) & 6) == 6;
+    #else
+        return __builtin_cpu_supports("avx");
+    #endif
+}
+
+#endif
@@ -2,23 +2,60 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "material.h"
 #include "rayTracer.h"
 
 class sphere : public hittable {
     private:
         point3 centre1;
-        double radius;
-        shared_ptr<material> mat;
+        real radius;
+        materialHandle mat;
         bool isMoving;
         vec3 centreVec;
         aabb bBox;
+        real uvDensity;     // The uv map covers area 1 with 4 pi r^2; this is its density at the equator, 1 / (sqrt(2) pi r).
 
-        point3 sphereCentre(double time) const {
+        point3 sphereCentre(real time) const {
             // Linearly interpolate from centre1 to centre2 accoedingf to time, where t=0 yields centre1 and t=1 yields centre2. 
             return centre1 + time * centreVec;
         }
 
-        static void getSphereUV(const point3& p, double & u, double& v) {
+        real subtendedCone(const point3& origin) const {
+            // 1 - cos(theta_max) of the cone from origin that just contains the sphere, or 0 if origin is inside it. Written
+            // as s / (1 + sqrt(1 - s)) so small, distant spheres keep their precision.
+            auto s = radius * radius / (centre1 - origin).lengthSquared();
+            if (!(s < 1)) return 0;
+            return s / (1 + sqrt(1 - s));
+        }
+
+        bool nearestRoot(const ray& r, interval rayT, real& root) const {
+            // The nearest distance in rayT at which r meets the sphere, without counting a test.
+            point3 centre = isMoving ? sphereCentre(r.time()) : centre1;
+            vec3 oc = centre - r.origin();
+            auto a = r.direction().lengthSquared();
+            auto h = dot(r.direction(), oc);
+            auto c = oc.lengthSquared() - radius * radius;
+
+            auto discriminant = h * h - a * c;
+            if (discriminant < 0) {
+                return false;
+            }
+
+            auto sqtd = sqrt(discriminant);
+
+            // Find the nearest root that lies in the acceptable range. 
+            root = (h - sqtd) / a;
+            if (!rayT.surrounds(root)) {
+                root = (h + sqtd) / a;
+
+                if (!rayT.surrounds(root)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        static void getSphereUV(const point3& p, real& u, real& v) {
             // p: a given point on the sphere of radius one, centered at the origin.
             // u: returned value [0,1] of angle around the Y axis from X=-1.
             // v: returned value [0,1] of angle from Y=-1 to Y=+1.
@@ -35,13 +72,15 @@ class sphere : public hittable {
 
     public: 
         // Stationary sphere. 
-        sphere(const point3& centre, double radius, shared_ptr<material> mat) : centre1(centre), radius(fmax(0, radius)), mat(mat), isMoving(false) {
+        sphere(const point3& centre, real radius, shared_ptr<material> mat) : centre1(centre), radius(fmax(0, radius)), mat(sceneMaterials().add(mat)), isMoving(false) {
+            uvDensity = radius > 0 ? 1 / (sqrt(real(2)) * pi * radius) : 0;
             auto rvec = vec3(radius, radius, radius);
             bBox = aabb(centre1 - rvec, centre1 + rvec);
         }
 
         // Moving sphere. 
-        sphere(const point3& centre1, const point3& centre2, double radius, shared_ptr<material> mat) : centre1(centre1), radius(fmax(0, radius)), mat(mat), isMoving(true) {
+        sphere(const point3& centre1, const point3& centre2, real radius, shared_ptr<material> mat) : centre1(centre1), radius(fmax(0, radius)), mat(sceneMaterials().add(mat)), isMoving(true) {
+            uvDensity = radius > 0 ? 1 / (sqrt(real(2)) * pi * radius) : 0;
             auto rvec = vec3(radius, radius, radius);
             aabb box1(centre1 - rvec, centre1 + rvec);
             aabb box2(centre2 - rvec, centre2 + rvec);
@@ -50,44 +89,60 @@ class sphere : public hittable {
             centreVec = centre2 - centre1;
         }
 
-        bool hit(const ray& r, interval rayT, hitRecord& rec) const override {
-            point3 centre = isMoving ? sphereCentre(r.time()) : centre1;
-            vec3 oc = centre - r.origin();
-            auto a = r.direction().lengthSquared();
-            auto h = dot(r.direction(), oc);
-            auto c = oc.lengthSquared() - radius * radius;
-
-            auto discriminant = h * h - a * c;
-            if (discriminant < 0) {
-                return false;
-            }
+        bool intersect(const ray& r, interval rayT, hitRecord& rec) const override {
+            countStat(statSphereTests);
+            real root;
+            if (!nearestRoot(r, rayT, root)) return false;
 
-            auto sqtd = sqrt(discriminant);
-
-            // Find the nearest root that lies in the acceptable range. 
-            auto root = (h - sqtd) / a;
-            if (!rayT.surrounds(root)) {
-                root = (h + sqtd) / a;
+            rec.t = root;
+            rec.object = this;
 
-                if (!rayT.surrounds(root)) {
-                    return false;
-                }
-            }
+            countStat(statSphereHits);
+            return true;
+        }
 
-            rec.t = root;
+        void completeHit(const ray& r, hitRecord& rec) const override {
+            point3 centre = isMoving ? sphereCentre(r.time()) : centre1;
             rec.p = r.at(rec.t);
             vec3 outwardNormal = (rec.p - centre) / radius;
             rec.setFaceNormal(r, outwardNormal);
             getSphereUV(outwardNormal, rec.u, rec.v);
+            rec.uvDensity = uvDensity;
             rec.mat = mat;
-
-            return true;
         }
 
         aabb boundingBox() const override { 
             return bBox; 
         }
 
+        real pdfValue(const point3& origin, const vec3& direction) const override {
+            // random() picks directions uniformly within the cone the sphere subtends. Lights are sampled where they are at
+            // time 0. The lookup is not a ray test, so it leaves the tracing statistics alone.
+            real root;
+            if (!nearestRoot(ray(origin, direction, 0), interval(0.001, infinity), root)) return 0;
+
+            auto coneMeasure = subtendedCone(origin);
+            return coneMeasure > 0 ? 1 / (2 * pi * coneMeasure) : 0;
+        }
+
+        vec3 random(const point3& origin) const override {
+            vec3 axis = centre1 - origin;
+            auto coneMeasure = subtendedCone(origin);
+            if (coneMeasure <= 0) return randomUnitVector();
+
+            // A uniform direction in the cone around +z, then turned onto the axis.
+            auto z = 1 - randomDouble() * coneMeasure;
+            auto phi = 2 * pi * randomDouble();
+            auto sinTheta = sqrt(std::fmax(real(0), 1 - z * z));
+            vec3 local(cos(phi) * sinTheta, sin(phi) * sinTheta, z);
+
+            vec3 w = unitVector(axis);
+            vec3 a = fabs(w.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+            vec3 v = unitVector(cross(w, a));
+            vec3 u = cross(w, v);
+            return local.x() * u + local.y() * v + local.z() * w;
+        }
+
 };
 
 #endif
\ No newline at end of file
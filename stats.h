@@ -0,0 +1,109 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+
+// Tracing statistics: how many rays were traced and how much BVH and primitive work they cost. The counters are only compiled in
+// when RAYTRACER_STATS is defined (cmake -DRAYTRACER_STATS=ON). Otherwise countStat() is empty and every call compiles away.
+
+#ifdef RAYTRACER_STATS
+    const bool statsEnabled = true;
+#else
+    const bool statsEnabled = false;
+#endif
+
+enum statCounter {
+    statCameraRays,
+    statBounces,
+    statShadowRays,
+    statRouletteKills,
+    statBvhNodeVisits,
+    statBoxTests,
+    statSphereTests,
+    statSphereHits,
+    statQuadTests,
+    statQuadHits,
+    statTriangleTests,
+    statTriangleHits,
+    statMediumTests,
+    statMediumHits,
+    statTranslateTests,
+    statTranslateHits,
+    statRotateYTests,
+    statRotateYHits,
+    statInstanceTests,
+    statInstanceHits,
+    statCounterCount
+};
+
+class tracingStats {
+  public:
+    uint64_t counts[statCounterCount] = {};
+
+    tracingStats& operator+=(const tracingStats& other) {
+        for (int c = 0; c < statCounterCount; c++) counts[c] += other.counts[c];
+        return *this;
+    }
+
+    tracingStats operator-(const tracingStats& other) const {
+        tracingStats difference;
+        for (int c = 0; c < statCounterCount; c++) difference.counts[c] = counts[c] - other.counts[c];
+        return difference;
+    }
+
+    uint64_t traversalCost() const {
+        // The work of finding hits: BVH nodes visited, boxes tested and primitives tested.
+        return counts[statBvhNodeVisits] + counts[statBoxTests] + counts[statSphereTests] + counts[statQuadTests]
+             + counts[statTriangleTests] + counts[statMediumTests] + counts[statTranslateTests] + counts[statRotateYTests]
+             + counts[statInstanceTests];
+    }
+
+    void print(std::ostream& out) const {
+        auto rays = counts[statCameraRays] + counts[statBounces] + counts[statShadowRays];
+        auto perRay = [rays](uint64_t count) { return rays > 0 ? double(count) / rays : 0.0; };
+
+        out << "Tracing statistics:\n";
+        out << "  camera rays      " << std::setw(14) << counts[statCameraRays] << '\n';
+        out << "  bounces          " << std::setw(14) << counts[statBounces] << '\n';
+        out << "  shadow rays      " << std::setw(14) << counts[statShadowRays] << '\n';
+        out << "  roulette ends    " << std::setw(14) << counts[statRouletteKills] << "  (paths ended by Russian roulette)\n";
+        out << "  BVH node visits  " << std::setw(14) << counts[statBvhNodeVisits] << "  (" << perRay(counts[statBvhNodeVisits]) << " per ray)\n";
+        out << "  box tests        " << std::setw(14) << counts[statBoxTests] << "  (" << perRay(counts[statBoxTests]) << " per ray)\n";
+        printPrimitive(out, "sphere", statSphereTests, perRay);
+        printPrimitive(out, "quad", statQuadTests, perRay);
+        printPrimitive(out, "triangle", statTriangleTests, perRay);
+        printPrimitive(out, "constantMedium", statMediumTests, perRay);
+        printPrimitive(out, "translate", statTranslateTests, perRay);
+        printPrimitive(out, "rotateY", statRotateYTests, perRay);
+        printPrimitive(out, "instance", statInstanceTests, perRay);
+    }
+
+  private:
+    template <typename perRayFunction>
+    void printPrimitive(std::ostream& out, const char* name, statCounter tests, perRayFunction perRay) const {
+        // A primitive's hit counter always follows its test counter.
+        auto testCount = counts[tests];
+        auto hitCount = counts[tests + 1];
+        out << "  " << std::left << std::setw(16) << name << std::right << ' ' << std::setw(14) << testCount << " tests, "
+            << hitCount << " hits  (" << perRay(testCount) << " tests per ray)\n";
+    }
+};
+
+inline tracingStats& threadStats(void) {
+    // The calling thread's counters. The camera adds up each tile's share, since render threads end with their pass.
+    thread_local tracingStats stats;
+    return stats;
+}
+
+inline void countStat(statCounter counter, uint64_t amount = 1) {
+    #ifdef RAYTRACER_STATS
+        threadStats().counts[counter] += amount;
+    #else
+        (void)counter;
+        (void)amount;
+    #endif
+}
+
+#endif
@@ -0,0 +1,330 @@
+#include "rayTracer.h"
+#include "accumulationBuffer.h"
+#include "bvh.h"
+#include "camera.h"
+#include "hittableList.h"
+#include "material.h"
+#include "mesh.h"
+#include "perlin.h"
+#include "sphere.h"
+#include "texture.h"
+#include "wideBvh.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+
+// Usage: RaytracerTests
+//
+// Runs every check below and prints the ones that fail. Exits with 1 if any did, so ctest reports it.
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << '\n';
+        failures++;
+    }
+}
+
+vec3 testDirection(int index) {
+    // Mostly random directions, with every eighth along an axis, where the slab tests divide by zero.
+    if (index % 8 == 0) {
+        vec3 axis(0, 0, 0);
+        axis[(index / 8) % 3] = (index / 24) % 2 ? 1 : -1;
+        return axis;
+    }
+    return randomUnitVector();
+}
+
+void testWideBvh(void) {
+    // bvh4 and bvh8 must find the same closest hit as bvh_node for any ray, from inside the scene or outside it.
+    seedRandom(1, 0);
+    hittableList spheres;
+    auto mat = make_shared<lambertian>(colour(0.5, 0.5, 0.5));
+    for (int i = 0; i < 3000; i++) {
+        spheres.add(make_shared<sphere>(point3::random(-50, 50), randomDouble(0.1, 2), mat));
+    }
+
+    bvh_node binary(spheres);
+    bvh4 wide4(spheres);
+    bvh8 wide8(spheres);
+
+    int mismatches4 = 0, mismatches8 = 0, hits = 0;
+    for (int i = 0; i < 20000; i++) {
+        ray r(point3::random(-80, 80), testDirection(i), 0);
+
+        hitRecord expected, got4, got8;
+        bool hitBinary = binary.intersect(r, interval(0.001, infinity), expected);
+        bool hit4 = wide4.intersect(r, interval(0.001, infinity), got4);
+        bool hit8 = wide8.intersect(r, interval(0.001, infinity), got8);
+        hits += hitBinary;
+
+        if (hit4 != hitBinary || (hitBinary && (got4.t != expected.t || got4.object != expected.object))) mismatches4++;
+        if (hit8 != hitBinary || (hitBinary && (got8.t != expected.t || got8.object != expected.object))) mismatches8++;
+    }
+
+    check(hits > 1000, "wide BVH test rays hit the scene");
+    check(mismatches4 == 0, "bvh4 finds the same closest hits as bvh_node");
+    check(mismatches8 == 0, "bvh8 finds the same closest hits as bvh_node");
+}
+
+bool writeObj(const meshData& mesh, const std::string& filename) {
+    // Every vertex gets the same index for its position, texture coordinates and normal, so loadObj rebuilds the same buffers.
+    std::ofstream file(filename);
+    file.precision(std::numeric_limits<float>::max_digits10);
+    file << "# Test mesh\ng test\n";
+    for (uint32_t v = 0; v < mesh.vertexCount; v++) {
+        file << "v " << mesh.positions[3 * v] << ' ' << mesh.positions[3 * v + 1] << ' ' << mesh.positions[3 * v + 2] << '\n';
+        file << "vt " << mesh.uvs[2 * v] << ' ' << mesh.uvs[2 * v + 1] << '\n';
+        file << "vn " << mesh.normals[3 * v] << ' ' << mesh.normals[3 * v + 1] << ' ' << mesh.normals[3 * v + 2] << '\n';
+    }
+    for (uint32_t t = 0; t < mesh.triangleCount; t++) {
+        file << 'f';
+        for (int k = 0; k < 3; k++) {
+            auto index = mesh.indices[3 * t + k] + 1;
+            file << ' ' << index << '/' << index << '/' << index;
+        }
+        file << '\n';
+    }
+    return bool(file);
+}
+
+bool sameTriangles(const meshData& a, const meshData& b) {
+    // Whether the meshes have the same triangles, corner by corner, however their vertices are numbered.
+    if (a.triangleCount != b.triangleCount || !a.normals != !b.normals || !a.uvs != !b.uvs) return false;
+    for (size_t corner = 0; corner < 3 * size_t(a.triangleCount); corner++) {
+        auto va = size_t(a.indices[corner]), vb = size_t(b.indices[corner]);
+        if (std::memcmp(a.positions + 3 * va, b.positions + 3 * vb, 3 * sizeof(float)) != 0) return false;
+        if (a.normals && std::memcmp(a.normals + 3 * va, b.normals + 3 * vb, 3 * sizeof(float)) != 0) return false;
+        if (a.uvs && std::memcmp(a.uvs + 2 * va, b.uvs + 2 * vb, 2 * sizeof(float)) != 0) return false;
+    }
+    return true;
+}
+
+bool sameBuffers(const meshData& a, const meshData& b) {
+    if (a.vertexCount != b.vertexCount || a.triangleCount != b.triangleCount) return false;
+    if (!a.normals != !b.normals || !a.uvs != !b.uvs) return false;
+    auto vertices = size_t(a.vertexCount);
+    return std::memcmp(a.positions, b.positions, 3 * vertices * sizeof(float)) == 0
+        && (!a.normals || std::memcmp(a.normals, b.normals, 3 * vertices * sizeof(float)) == 0)
+        && (!a.uvs || std::memcmp(a.uvs, b.uvs, 2 * vertices * sizeof(float)) == 0)
+        && std::memcmp(a.indices, b.indices, 3 * size_t(a.triangleCount) * sizeof(uint32_t)) == 0;
+}
+
+framebuffer renderMesh(shared_ptr<const meshData> data) {
+    // A small, quick render of the mesh from above and to the side, lit by the background alone.
+    hittableList world;
+    world.add(make_shared<triangleMesh>(data, make_shared<lambertian>(colour(0.7, 0.7, 0.7))));
+
+    camera cam;
+    cam.imageWidth = 48;
+    cam.samplesPerPixel = 4;
+    cam.maxDepth = 4;
+    cam.threadCount = 1;
+    cam.background = colour(0.7, 0.8, 1.0);
+    cam.vFieldOfView = 40;
+    cam.lookFrom = point3(0, 3, 3);
+    cam.lookAt = point3(0, 0, 0);
+    cam.vUp = vec3(0, 1, 0);
+    cam.defocusAngle = 0;
+    return cam.renderImage(world, nullptr);
+}
+
+void testMeshLoaders(void) {
+    // An OBJ file converted to the binary format must load back to the same buffers, and render the same image.
+    auto torus = torusMesh(1, 0.4, 48, 24);
+    const std::string objFile = "testMesh.obj", binaryFile = "testMesh.rtmesh";
+
+    check(writeObj(*torus, objFile), "test OBJ file is written");
+    auto fromObj = loadObj(objFile);
+    check(fromObj && fromObj->vertexCount == torus->vertexCount && sameTriangles(*torus, *fromObj), "loadObj reads back the mesh's triangles");
+    if (!fromObj) return;
+
+    check(saveBinaryMesh(*fromObj, binaryFile), "saveBinaryMesh writes the OBJ mesh");
+    auto fromBinary = loadMesh(binaryFile);
+    check(fromBinary && sameBuffers(*fromObj, *fromBinary), "loadBinaryMesh maps the same buffers");
+    if (!fromBinary) return;
+
+    auto objImage = renderMesh(fromObj);
+    auto binaryImage = renderMesh(fromBinary);
+    bool same = true, showsMesh = false;
+    for (int j = 0; j < objImage.height(); j++) {
+        for (int i = 0; i < objImage.width(); i++) {
+            auto pixel = binaryImage.pixel(i, j), objPixel = objImage.pixel(i, j);
+            same = same && objPixel.x() == pixel.x() && objPixel.y() == pixel.y() && objPixel.z() == pixel.z();
+            showsMesh = showsMesh || pixel.x() < 0.5;     // Background pixels have red 0.7; the mesh is darker.
+        }
+    }
+    check(same, "the OBJ and binary meshes render the same image");
+    check(showsMesh, "the mesh shows in its render");
+
+    // The torus is closed and its triangles share vertices, so a ray aimed at any vertex from outside must hit the mesh.
+    triangleMesh mesh(fromBinary, make_shared<lambertian>(colour(0.5, 0.5, 0.5)));
+    int misses = 0;
+    for (uint32_t v = 0; v < fromBinary->vertexCount; v++) {
+        auto p = fromBinary->position(v);
+        ray r(p + vec3(0, 5, 0), vec3(0, -1, 0), 0);
+        hitRecord rec;
+        if (!mesh.intersect(r, interval(0.001, infinity), rec)) misses++;
+    }
+    check(misses == 0, "rays through the mesh's vertices never slip between its triangles");
+
+    std::remove(objFile.c_str());
+    std::remove(binaryFile.c_str());
+}
+
+void testTurbulenceGrid(void) {
+    // At its grid points a baked grid must give the turbulence itself, to float precision. Outside its box a baked texture
+    // must give exactly what the unbaked one does.
+    seedRandom(2, 0);
+    perlin noise;
+    const int resolution = 9, depth = 7;
+    aabb region(point3(-1, 0, -2), point3(3, 2, 1));
+    turbulenceGrid grid(noise, region, resolution, depth, 1);
+
+    double worst = 0;
+    for (int k = 0; k < resolution; k++) {
+        for (int j = 0; j < resolution; j++) {
+            for (int i = 0; i < resolution; i++) {
+                point3 p(region.x.min + region.x.size() * i / (resolution - 1), region.y.min + region.y.size() * j / (resolution - 1),
+                         region.z.min + region.z.size() * k / (resolution - 1));
+                worst = std::fmax(worst, fabs(grid.value(p) - noise.turbulance(p, depth)));
+            }
+        }
+    }
+    check(worst < 1e-5, "a baked turbulence grid matches perlin::turbulance at its grid points");
+
+    seedRandom(3, 0);
+    noiseTexture plain(4);
+    seedRandom(3, 0);
+    noiseTexture baked(4);
+    baked.bake(region, resolution, 1);
+
+    int outside = 0, differ = 0;
+    for (int n = 0; n < 1000; n++) {
+        auto p = point3::random(-5, 5);
+        if (grid.contains(p)) continue;
+        outside++;
+        auto a = plain.value(0, 0, p), b = baked.value(0, 0, p);
+        if (a.x() != b.x() || a.y() != b.y() || a.z() != b.z()) differ++;
+    }
+    check(outside > 500 && differ == 0, "a baked noise texture evaluates points outside its grid directly");
+}
+
+void testMaterialRegistries(void) {
+    // A handle names a material only in the registry that made it, so a primitive rendered with another registry is caught.
+    auto grey = make_shared<lambertian>(colour(0.5, 0.5, 0.5));
+    materialRegistry first, second;
+    auto handle = first.add(grey);
+    check(first.owns(handle) && first[handle] == grey.get(), "a registry looks up its own handles");
+    check(first.add(grey) == handle, "a material added twice keeps its handle");
+    check(second.add(grey) != handle && !second.owns(handle), "registries do not accept each other's handles");
+
+    sphere outside(point3(0, 0, 0), 1, grey);
+    hitRecord rec;
+    bool hit = outside.intersect(ray(point3(0, 0, 5), vec3(0, 0, -1), 0), interval(0.001, infinity), rec);
+    outside.completeHit(ray(point3(0, 0, 5), vec3(0, 0, -1), 0), rec);
+    check(hit && sceneMaterials().owns(rec.mat) && !first.owns(rec.mat), "primitives made outside a scene use the unscoped registry");
+
+    {
+        materialScope scope(first);
+        sphere inside(point3(0, 0, 0), 1, make_shared<lambertian>(colour(0.2, 0.2, 0.2)));
+        inside.intersect(ray(point3(0, 0, 5), vec3(0, 0, -1), 0), interval(0.001, infinity), rec);
+        inside.completeHit(ray(point3(0, 0, 5), vec3(0, 0, -1), 0), rec);
+        check(first.owns(rec.mat) && materialRegistry::indexOf(rec.mat) == 1, "primitives made in a materialScope use its registry");
+    }
+}
+
+bool readsBack(const accumulationBuffer& buffer, const std::string& filename) {
+    accumulationBuffer copy;
+    return buffer.write(filename) && copy.read(filename);
+}
+
+void testShardHeaders(void) {
+    // A partial file whose header puts its region outside the image, or promises more data than it holds, must be refused
+    // before anything is allocated or written from it.
+    const std::string filename = "testShard.rtacc";
+    accumulationBuffer good(8, 4, 2, 1, 4, 2);
+    good.sampleCount = 3;
+    good.job.meshFile = "a mesh.obj";
+    accumulationBuffer copy;
+    check(good.write(filename) && copy.read(filename) && copy.job == good.job && copy.left == 2 && copy.height == 2,
+          "a partial file reads back its header");
+
+    auto outside = good;
+    outside.left = 6;
+    check(!readsBack(outside, filename), "a partial file whose region leaves the image is refused");
+    auto negative = good;
+    negative.top = -1;
+    check(!readsBack(negative, filename), "a partial file with a negative region corner is refused");
+    auto huge = good;
+    huge.imageWidth = 1 << 30;
+    check(!readsBack(huge, filename), "a partial file with an implausible image size is refused");
+    auto badShard = good;
+    badShard.job.shardIndex = 2;
+    check(!readsBack(badShard, filename), "a partial file naming a shard past its shard count is refused");
+
+    // A header that claims the whole image over data for a 4 x 2 region.
+    std::string contents;
+    {
+        good.write(filename);
+        std::ifstream file(filename, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    auto region = contents.find("2 1 4 2");
+    if (region != std::string::npos) contents.replace(region, 7, "0 0 8 4");
+    std::ofstream(filename, std::ios::binary) << contents;
+    check(region != std::string::npos && !copy.read(filename), "a partial file with less data than its header needs is refused");
+
+    std::remove(filename.c_str());
+}
+
+void testAdaptiveBudget(void) {
+    // 30 x 17 pixels do not divide into whole 4 x 2 blocks, so the last samples of the budget only fit the edge blocks. The
+    // render must spend them there, or stop, rather than repeat a round that schedules nothing.
+    hittableList world;
+    world.add(make_shared<sphere>(point3(0, 0, 0), 1, make_shared<lambertian>(colour(0.5, 0.5, 0.5))));
+
+    camera cam;
+    cam.imageWidth = 30;
+    cam.aspectRatio = 30.0 / 17;
+    cam.samplesPerPixel = 5;
+    cam.minSamples = 4;
+    cam.maxDepth = 4;
+    cam.threadCount = 1;
+    cam.background = colour(0.7, 0.8, 1.0);
+    cam.vFieldOfView = 40;
+    cam.lookFrom = point3(0, 0, 4);
+    cam.lookAt = point3(0, 0, 0);
+    cam.vUp = vec3(0, 1, 0);
+    cam.defocusAngle = 0;
+    cam.adaptiveSampling = true;
+    cam.adaptiveThreshold = 1e-5;   // Every block stays noisy, so the budget runs out.
+    cam.renderImage(world, nullptr);
+
+    auto budget = uint64_t(cam.samplesPerPixel) * 30 * 17;
+    check(cam.statistics.samples <= budget, "adaptive sampling stays within its budget");
+    check(cam.statistics.samples + rayPacket::size > budget, "adaptive sampling spends its budget down to less than a block");
+}
+
+int main(int argc, char* argv[]) {
+    (void)argc;
+    (void)argv;
+
+    testWideBvh();
+    testMeshLoaders();
+    testTurbulenceGrid();
+    testMaterialRegistries();
+    testShardHeaders();
+    testAdaptiveBudget();
+
+    if (failures > 0) {
+        std::cerr << failures << " checks failed.\n";
+        return 1;
+    }
+    std::clog << "All checks passed.\n";
+    return 0;
+}
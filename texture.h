@@ -1,6 +1,7 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include "mipmap.h"
 #include "perlin.h"
 #include "rayTracer.h"
 #include "rtw_stb_image.h"
@@ -9,8 +10,13 @@ class texture {
     public: 
         virtual ~texture() = default;
 
-        virtual colour value(double u, double v, const point3& p) const = 0;
+        virtual colour value(real u, real v, const point3& p) const = 0;
 
+        virtual colour filteredValue(real u, real v, const point3& p, real footprint) const {
+            // The texture averaged over a region `footprint` wide in uv units around (u, v). Textures without prefiltered
+            // detail ignore the footprint.
+            return value(u, v, p);
+        }
 };
 
 class solidColour : public texture {
@@ -19,7 +25,7 @@ class solidColour : public texture {
 
         solidColour(double red, double green, double blue) : solidColour(colour(red, green, blue)) {}
 
-        colour value(double u, double v, const point3& p) const override {
+        colour value(real u, real v, const point3& p) const override {
             return albedo;
         }
 
@@ -33,7 +39,7 @@ class checkerTexture : public texture {
 
         checkerTexture(double scale, const colour& c1, const colour& c2) : invScale(1.0 / scale), even(make_shared<solidColour>(c1)), odd(make_shared<solidColour>(c2)) {}
 
-        colour value(double u, double v, const point3& p) const override {
+        colour value(real u, real v, const point3& p) const override {
             auto xInteger = int(std::floor(invScale * p.x()));
             auto yInteger = int(std::floor(invScale * p.y()));
             auto zInteger = int(std::floor(invScale * p.z()));
@@ -51,26 +57,26 @@ class checkerTexture : public texture {
 
 class imageTexture : public texture {
     public:
-        imageTexture(const char* filename) : image(filename) {}
+        // The file is decoded once into the mip chain, then its float and byte copies are freed.
+        imageTexture(const char* filename) : texels(rtwImage(filename)) {}
+
+        colour value(real u, real v, const point3& p) const override {
+            return filteredValue(u, v, p, 0);
+        }
 
-        colour value(double u, double v, const point3& p) const override {
+        colour filteredValue(real u, real v, const point3& p, real footprint) const override {
             // If no texture deta, then return solid cyan. 
-            if (image.height() <= 0) return colour(0, 1, 1);
+            if (texels.empty()) return colour(0, 1, 1);
 
             // Clamp input texture coordinates to [0, 1] x [1, 0]. 
             u = interval(0, 1).clamp(u);
             v = 1.0 - interval(0,1).clamp(v); // Flip v to image coordinates. 
 
-            auto i = int(u * image.width());
-            auto j = int(v * image.height());
-            auto pixel = image.pixelData(i, j);
-
-            auto colourScale = 1.0 / 255.0;
-            return colour(colourScale * pixel[0], colourScale * pixel[1], colourScale * pixel[2]);
+            return texels.lookup(texels.levelFor(footprint), u, v);
         }
 
     private:
-        rtwImage image;
+        mipmap texels;
 };
 
 class noiseTexture : public texture {
@@ -79,13 +85,22 @@ class noiseTexture : public texture {
 
     noiseTexture(double scale) : scale(scale) {}
 
-    colour value(double u, double v, const point3& p) const override {
-        return colour(0.5, 0.5, 0.5) * (1 + sin(scale * p.z() + 10 * noise.turbulance(p, 7)));
+    void bake(const aabb& region, int resolution, int threadCount = 0) {
+        // Precompute the turbulence over region on a resolution^3 grid (4 bytes per point). Points inside it are then looked
+        // up instead of evaluated, at the cost of detail finer than the grid spacing; points outside are evaluated as before.
+        baked = turbulenceGrid(noise, region, resolution, turbulenceDepth, threadCount);
+    }
+
+    colour value(real u, real v, const point3& p) const override {
+        auto turbulence = !baked.empty() && baked.contains(p) ? baked.value(p) : noise.turbulance(p, turbulenceDepth);
+        return colour(0.5, 0.5, 0.5) * (1 + sin(scale * p.z() + 10 * turbulence));
     }
 
   private:
+    static const int turbulenceDepth = 7;
     perlin noise;
     double scale;
+    turbulenceGrid baked;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,106 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class threadPool {
+    public:
+        threadPool(int threadCount = 0) : threadCount(resolveThreadCount(threadCount)) {}
+
+        int size() const {
+            return threadCount;
+        }
+
+        void parallelFor(int taskCount, const std::function<void(int)>& task) {
+            /*
+            * Runs task(i) for every i in [0, taskCount) on the pool's threads.
+            *
+            * Each worker starts with its own contiguous share of the task indices and takes work
+            * from the front of its queue. A worker that runs dry steals from the back of another
+            * worker's queue, so uneven tasks (e.g. tiles covering glass or smoke) balance out.
+            */
+
+            if (taskCount <= 0) return;
+
+            int workerCount = threadCount < taskCount ? threadCount : taskCount;
+            if (workerCount <= 1) {
+                for (int i = 0; i < taskCount; i++) task(i);
+                return;
+            }
+
+            std::vector<workQueue> queues(workerCount);
+            for (int w = 0; w < workerCount; w++) {
+                int first = int((long long)taskCount * w / workerCount);
+                int last = int((long long)taskCount * (w + 1) / workerCount);
+                for (int i = first; i < last; i++) queues[w].tasks.push_back(i);
+            }
+
+            auto worker = [&](int self) {
+                int taskIndex;
+                while (popOwn(queues[self], taskIndex) || steal(queues, self, taskIndex)) {
+                    task(taskIndex);
+                }
+            };
+
+            std::vector<std::thread> threads;
+            threads.reserve(workerCount - 1);
+            for (int w = 1; w < workerCount; w++) threads.emplace_back(worker, w);
+
+            // The calling thread is worker 0.
+            worker(0);
+
+            for (auto& t : threads) t.join();
+        }
+
+    private:
+        struct workQueue {
+            std::mutex lock;
+            std::deque<int> tasks;
+        };
+
+        int threadCount;
+
+        static int resolveThreadCount(int requested) {
+            // A non-positive request uses the RAYTRACER_THREADS environment variable if it is set, otherwise every hardware thread.
+            if (requested > 0) return requested;
+
+            if (auto env = std::getenv("RAYTRACER_THREADS")) {
+                int fromEnvironment = std::atoi(env);
+                if (fromEnvironment > 0) return fromEnvironment;
+            }
+
+            int hardware = int(std::thread::hardware_concurrency());
+            return hardware > 0 ? hardware : 1;
+        }
+
+        static bool popOwn(workQueue& queue, int& taskIndex) {
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (queue.tasks.empty()) return false;
+
+            taskIndex = queue.tasks.front();
+            queue.tasks.pop_front();
+            return true;
+        }
+
+        static bool steal(std::vector<workQueue>& queues, int self, int& taskIndex) {
+            // Visit the other workers in order, starting after our own queue, and take from the back of the first non-empty one.
+            int count = int(queues.size());
+            for (int offset = 1; offset < count; offset++) {
+                auto& victim = queues[(self + offset) % count];
+                std::lock_guard<std::mutex> guard(victim.lock);
+                if (victim.tasks.empty()) continue;
+
+                taskIndex = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+            return false;
+        }
+};
+
+#endif
@@ -2,133 +2,326 @@
 #define VEC3_H
 
 #include "rayTracer.h"
+#include "simd.h"
+
+template <typename T>
+class vec3Lanes {
+    /*
+    * The arithmetic behind vec3T<T>, on its component array. This scalar backend stores exactly
+    * three components. The SIMD backends below store four, aligned, with the fourth always zero,
+    * so one register holds a whole vector.
+    */
+  public:
+    static constexpr int count = 3;
+    static constexpr int alignment = alignof(T);
+
+    static void add(const T* u, const T* v, T* out) {
+        for (int i = 0; i < 3; i++) out[i] = u[i] + v[i];
+    }
+
+    static void subtract(const T* u, const T* v, T* out) {
+        for (int i = 0; i < 3; i++) out[i] = u[i] - v[i];
+    }
+
+    static void multiply(const T* u, const T* v, T* out) {
+        for (int i = 0; i < 3; i++) out[i] = u[i] * v[i];
+    }
+
+    static void scale(T t, const T* v, T* out) {
+        for (int i = 0; i < 3; i++) out[i] = t * v[i];
+    }
+
+    static T dot(const T* u, const T* v) {
+        return u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
+    }
+
+    static void cross(const T* u, const T* v, T* out) {
+        T x = u[1] * v[2] - u[2] * v[1];
+        T y = u[2] * v[0] - u[0] * v[2];
+        T z = u[0] * v[1] - u[1] * v[0];
+        out[0] = x;
+        out[1] = y;
+        out[2] = z;
+    }
+};
+
+// The SIMD backends, chosen at compile time with RAYTRACER_SIMD_VEC3 (cmake -DRAYTRACER_SIMD_VEC3=ON). float vectors use one SSE
+// register. double vectors use one AVX register when the whole build targets AVX (e.g. -mavx), and two SSE2 registers otherwise.
+// Dot products add the lanes in the scalar order, (x + y) + z, so results match the scalar backend.
+#if defined(RAYTRACER_SIMD_VEC3) && defined(RAYTRACER_X86)
+
+template <>
+class vec3Lanes<float> {
+  public:
+    static constexpr int count = 4;
+    static constexpr int alignment = 16;
+
+    static void add(const float* u, const float* v, float* out) {
+        _mm_store_ps(out, _mm_add_ps(_mm_load_ps(u), _mm_load_ps(v)));
+    }
+
+    static void subtract(const float* u, const float* v, float* out) {
+        _mm_store_ps(out, _mm_sub_ps(_mm_load_ps(u), _mm_load_ps(v)));
+    }
+
+    static void multiply(const float* u, const float* v, float* out) {
+        _mm_store_ps(out, _mm_mul_ps(_mm_load_ps(u), _mm_load_ps(v)));
+    }
+
+    static void scale(float t, const float* v, float* out) {
+        _mm_store_ps(out, _mm_mul_ps(_mm_set1_ps(t), _mm_load_ps(v)));
+    }
+
+    static float dot(const float* u, const float* v) {
+        __m128 m = _mm_mul_ps(_mm_load_ps(u), _mm_load_ps(v));
+        __m128 xy = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(_mm_add_ss(xy, _mm_movehl_ps(m, m)));
+    }
+
+    static void cross(const float* u, const float* v, float* out) {
+        // u * v.yzx - u.yzx * v is the cross product in zxy order; one more shuffle puts it back. The fourth lane stays zero.
+        __m128 a = _mm_load_ps(u), b = _mm_load_ps(v);
+        __m128 aYzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 bYzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYzx), _mm_mul_ps(aYzx, b));
+        _mm_store_ps(out, _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+    }
+};
+
+#ifdef __AVX__
+
+template <>
+class vec3Lanes<double> {
+  public:
+    static constexpr int count = 4;
+    static constexpr int alignment = 32;
+
+    static void add(const double* u, const double* v, double* out) {
+        _mm256_store_pd(out, _mm256_add_pd(_mm256_load_pd(u), _mm256_load_pd(v)));
+    }
+
+    static void subtract(const double* u, const double* v, double* out) {
+        _mm256_store_pd(out, _mm256_sub_pd(_mm256_load_pd(u), _mm256_load_pd(v)));
+    }
+
+    static void multiply(const double* u, const double* v, double* out) {
+        _mm256_store_pd(out, _mm256_mul_pd(_mm256_load_pd(u), _mm256_load_pd(v)));
+    }
+
+    static void scale(double t, const double* v, double* out) {
+        _mm256_store_pd(out, _mm256_mul_pd(_mm256_set1_pd(t), _mm256_load_pd(v)));
+    }
+
+    static double dot(const double* u, const double* v) {
+        __m256d m = _mm256_mul_pd(_mm256_load_pd(u), _mm256_load_pd(v));
+        __m128d low = _mm256_castpd256_pd128(m);
+        __m128d xy = _mm_add_sd(low, _mm_unpackhi_pd(low, low));
+        return _mm_cvtsd_f64(_mm_add_sd(xy, _mm256_extractf128_pd(m, 1)));
+    }
+
+    static void cross(const double* u, const double* v, double* out) {
+        // AVX has no cheap shuffle across its two halves, so the cross product stays scalar.
+        double x = u[1] * v[2] - u[2] * v[1];
+        double y = u[2] * v[0] - u[0] * v[2];
+        double z = u[0] * v[1] - u[1] * v[0];
+        out[0] = x;
+        out[1] = y;
+        out[2] = z;
+    }
+};
+
+#else
+
+template <>
+class vec3Lanes<double> {
+    // Without AVX, x and y share one SSE2 register and z (with the zero fourth lane) the other.
+  public:
+    static constexpr int count = 4;
+    static constexpr int alignment = 16;
 
-class vec3 {
+    static void add(const double* u, const double* v, double* out) {
+        _mm_store_pd(out, _mm_add_pd(_mm_load_pd(u), _mm_load_pd(v)));
+        _mm_store_pd(out + 2, _mm_add_pd(_mm_load_pd(u + 2), _mm_load_pd(v + 2)));
+    }
+
+    static void subtract(const double* u, const double* v, double* out) {
+        _mm_store_pd(out, _mm_sub_pd(_mm_load_pd(u), _mm_load_pd(v)));
+        _mm_store_pd(out + 2, _mm_sub_pd(_mm_load_pd(u + 2), _mm_load_pd(v + 2)));
+    }
+
+    static void multiply(const double* u, const double* v, double* out) {
+        _mm_store_pd(out, _mm_mul_pd(_mm_load_pd(u), _mm_load_pd(v)));
+        _mm_store_pd(out + 2, _mm_mul_pd(_mm_load_pd(u + 2), _mm_load_pd(v + 2)));
+    }
+
+    static void scale(double t, const double* v, double* out) {
+        __m128d s = _mm_set1_pd(t);
+        _mm_store_pd(out, _mm_mul_pd(s, _mm_load_pd(v)));
+        _mm_store_pd(out + 2, _mm_mul_pd(s, _mm_load_pd(v + 2)));
+    }
+
+    static double dot(const double* u, const double* v) {
+        __m128d m = _mm_mul_pd(_mm_load_pd(u), _mm_load_pd(v));
+        __m128d xy = _mm_add_sd(m, _mm_unpackhi_pd(m, m));
+        return _mm_cvtsd_f64(_mm_add_sd(xy, _mm_mul_sd(_mm_load_sd(u + 2), _mm_load_sd(v + 2))));
+    }
+
+    static void cross(const double* u, const double* v, double* out) {
+        double x = u[1] * v[2] - u[2] * v[1];
+        double y = u[2] * v[0] - u[0] * v[2];
+        double z = u[0] * v[1] - u[1] * v[0];
+        out[0] = x;
+        out[1] = y;
+        out[2] = z;
+    }
+};
+
+#endif
+
+#endif
+
+template <typename T>
+class vec3T {
+    /*
+    * A three-component vector of scalar type T. The renderer uses vec3 (vec3T<real>), and vec3d
+    * wherever sums need double precision whatever real is.
+    *
+    * The arithmetic is defined as hidden friends, found by argument-dependent lookup, so mixed
+    * arguments such as 0.5 * v convert implicitly just as they did before vec3 was a template.
+    * vec3Lanes<T> does the work, so the SIMD backend changes the layout but not the interface.
+    */
     public:
-        double e[3];
+        alignas(vec3Lanes<T>::alignment) T e[vec3Lanes<T>::count];
+
+        vec3T() : e{0, 0, 0} {}
+        vec3T(T e0, T e1, T e2) : e{e0, e1, e2} {}
 
-        vec3() : e{0, 0, 0} {}
-        vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+        template <typename U>
+        explicit vec3T(const vec3T<U>& v) : e{T(v.e[0]), T(v.e[1]), T(v.e[2])} {}
 
-        double x() const {
+        T x() const {
             return e[0];
         }
 
-        double y() const {
+        T y() const {
             return e[1];
         }
 
-        double z() const {
+        T z() const {
             return e[2];
         }
 
-        vec3 operator-()const {
-            return vec3(-e[0], -e[1], -e[2]);
+        vec3T operator-()const {
+            vec3T result;
+            vec3Lanes<T>::scale(T(-1), e, result.e);
+            return result;
         }
 
-        double operator[](int i) const {
+        T operator[](int i) const {
             return e[i];
         }
 
-        double& operator[](int i) {
+        T& operator[](int i) {
             return e[i];
         }
 
-        vec3& operator+=(const vec3& v) {
-            e[0] += v.e[0];
-            e[1] += v.e[1];
-            e[2] += v.e[2];
-
+        vec3T& operator+=(const vec3T& v) {
+            vec3Lanes<T>::add(e, v.e, e);
             return *this;
         }
 
-        vec3& operator*=(double t) {
-            e[0] *= t;
-            e[1] *= t;
-            e[2] *= t;
-
+        vec3T& operator*=(T t) {
+            vec3Lanes<T>::scale(t, e, e);
             return *this;
         }
 
-        vec3& operator/=(double t) {
+        vec3T& operator/=(T t) {
             return *this *= 1/t;
         }
 
-        double length() const {
+        T length() const {
             return sqrt(lengthSquared());
         }
 
-        double lengthSquared() const {
-            return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
+        T lengthSquared() const {
+            return vec3Lanes<T>::dot(e, e);
         }
 
         bool nearZero() const {
             // Return true if the vector is close to zero in all dimensions. 
-            auto s = 1e-8;
+            auto s = T(1e-8);
             return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
         }
 
-        static vec3 random() {
-            return vec3(randomDouble(), randomDouble(), randomDouble());
+        static vec3T random() {
+            return vec3T(T(randomDouble()), T(randomDouble()), T(randomDouble()));
         }
 
-        static vec3 random(double min, double max) {
-            return vec3(randomDouble(min,max), randomDouble(min,max), randomDouble(min,max));
+        static vec3T random(double min, double max) {
+            return vec3T(T(randomDouble(min,max)), T(randomDouble(min,max)), T(randomDouble(min,max)));
         }
 
-};
+        // Vector Utility Functions. 
+        friend std::ostream& operator<<(std::ostream& out, const vec3T& v) {
+            return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
+        }
 
-// point3 is just an alias for vec3, but useful for geometric clarity in the code.
-using point3 = vec3;
+        friend vec3T operator+(const vec3T& u, const vec3T& v) {
+            vec3T result;
+            vec3Lanes<T>::add(u.e, v.e, result.e);
+            return result;
+        }
 
-// Vector Utility Functions. 
-inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
-    return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
-}
+        friend vec3T operator-(const vec3T& u, const vec3T& v) {
+            vec3T result;
+            vec3Lanes<T>::subtract(u.e, v.e, result.e);
+            return result;
+        }
 
-inline vec3 operator+(const vec3& u, const vec3& v) {
-    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
-}
+        friend vec3T operator*(const vec3T& u, const vec3T& v) {
+            vec3T result;
+            vec3Lanes<T>::multiply(u.e, v.e, result.e);
+            return result;
+        }
 
-inline vec3 operator-(const vec3& u, const vec3& v) {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
-}
+        friend vec3T operator*(T t, const vec3T& v) {
+            vec3T result;
+            vec3Lanes<T>::scale(t, v.e, result.e);
+            return result;
+        }
 
-inline vec3 operator*(const vec3& u, const vec3& v) {
-    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
-}
+        friend vec3T operator*(const vec3T& v, T t) {
+            return t * v;
+        }
 
-inline vec3 operator*(double t, const vec3& v) {
-    return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
-}
+        friend vec3T operator/(const vec3T& v, T t) {
+            return (1/t) * v;
+        }
 
-inline vec3 operator*(const vec3& v, double t) {
-    return t * v;
-}
+        friend T dot(const vec3T& u, const vec3T& v) {
+            return vec3Lanes<T>::dot(u.e, v.e);
+        }
 
-inline vec3 operator/(const vec3& v, double t) {
-    return (1/t) * v;
-}
+        friend vec3T cross(const vec3T& u, const vec3T& v) {
+            vec3T result;
+            vec3Lanes<T>::cross(u.e, v.e, result.e);
+            return result;
+        }
 
-inline double dot(const vec3& u, const vec3& v) {
-    return u.e[0] * v.e[0]
-         + u.e[1] * v.e[1]
-         + u.e[2] * v.e[2];
-}
+        friend vec3T unitVector(const vec3T& v) {
+            return v / v.length();
+        }
+};
 
-inline vec3 cross(const vec3& u, const vec3& v) {
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-                u.e[2] * v.e[0] - u.e[0] * v.e[2],
-                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
-}
+using vec3 = vec3T<real>;
+using vec3d = vec3T<double>;
 
-inline vec3 unitVector(const vec3& v) {
-    return v / v.length();
-}
+// point3 is just an alias for vec3, but useful for geometric clarity in the code.
+using point3 = vec3;
 
 inline vec3 randomInUnitDisk(void) {
     while (true) {
-        auto p = vec3(randomDouble(-1, 1), randomDouble(-1, 1), 0);
+        auto p = vec3(real(randomDouble(-1, 1)), real(randomDouble(-1, 1)), 0);
         if (p.lengthSquared() < 1) return p;
     }
 }
@@ -157,10 +350,10 @@ inline vec3 reflect(const vec3& v, const vec3& n) {
     return v - 2 * dot(v, n) * n;
 }
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etaiOverEtat) {
-    auto cosTheta = fmin(dot(-uv, n), 1.0);
+inline vec3 refract(const vec3& uv, const vec3& n, real etaiOverEtat) {
+    auto cosTheta = std::fmin(dot(-uv, n), real(1));
     vec3 rOutPerp =  etaiOverEtat * (uv + cosTheta * n);
-    vec3 rOutParallel = -sqrt(fabs(1.0 - rOutPerp.lengthSquared())) * n;
+    vec3 rOutParallel = -sqrt(fabs(1 - rOutPerp.lengthSquared())) * n;
     return rOutPerp + rOutParallel;
 }
 
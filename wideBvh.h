@@ -0,0 +1,337 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittableList.h"
+#include "rayTracer.h"
+#include "simd.h"
+
+#include <cstdint>
+#include <vector>
+
+template <int width>
+class alignas(32) wideBvhNode {
+    /*
+    * A node with up to `width` children. Child bounds are stored as structure-of-arrays, so one
+    * SIMD instruction handles the same slab of every child.
+    *
+    * A child with count[i] == 0 is an interior node and child[i] is its node index. A child with
+    * count[i] > 0 is a leaf holding primitives child[i] .. child[i] + count[i] - 1. Unused slots
+    * have inverted (empty) bounds, so the box test always rejects them.
+    */
+  public:
+    float minX[width], minY[width], minZ[width];
+    float maxX[width], maxY[width], maxZ[width];
+    uint32_t child[width];
+    uint16_t count[width];
+
+    wideBvhNode() {
+        for (int i = 0; i < width; i++) {
+            minX[i] = minY[i] = minZ[i] = std::numeric_limits<float>::infinity();
+            maxX[i] = maxY[i] = maxZ[i] = -std::numeric_limits<float>::infinity();
+            child[i] = 0;
+            count[i] = 0;
+        }
+    }
+};
+
+class wideRay {
+    // The single-precision ray data shared by every box test of one traversal.
+  public:
+    float origin[3];
+    float invDirection[3];
+    float originError[3];   // See originRoundingError().
+    int dirIsNeg[3];
+    float tMin;
+    float tMax;
+};
+
+// Scale applied to each box's far distance to cover the relative rounding of the float slab arithmetic. Together with the
+// origin's rounding error (wideRay::originError), which widens every slab, and bounds rounded outwards, the box tests never
+// reject a box the ray truly hits.
+const float wideBoxFarScale = 1.0f + 2.0f * 3.0f * std::numeric_limits<float>::epsilon();
+
+template <int width>
+inline int intersectChildren(const wideBvhNode<width>& node, const wideRay& r, float tNear[width]) {
+    // Portable fallback: test the ray against each child box. Returns a bit mask of the children hit.
+    // Like linearBvhNode::hit, the ray's direction signs pick each child's near and far slab, so no swaps are needed. Empty
+    // slots have min > max, which makes their near distance +infinity. NaNs (from 0 * infinity) are ignored by the comparisons.
+    int mask = 0;
+    const float* mins[3] = { node.minX, node.minY, node.minZ };
+    const float* maxs[3] = { node.maxX, node.maxY, node.maxZ };
+
+    for (int i = 0; i < width; i++) {
+        float t0 = r.tMin, t1 = r.tMax;
+        for (int a = 0; a < 3; a++) {
+            float nearSlab = r.dirIsNeg[a] ? maxs[a][i] : mins[a][i];
+            float farSlab = r.dirIsNeg[a] ? mins[a][i] : maxs[a][i];
+            float tA = (nearSlab - r.origin[a]) * r.invDirection[a] - r.originError[a];
+            float tB = (farSlab - r.origin[a]) * r.invDirection[a] * wideBoxFarScale + r.originError[a];
+            if (tA > t0) t0 = tA;
+            if (tB < t1) t1 = tB;
+        }
+        tNear[i] = t0;
+        if (t0 <= t1) mask |= 1 << i;
+    }
+    return mask;
+}
+
+#ifdef RAYTRACER_X86
+template <>
+inline int intersectChildren<4>(const wideBvhNode<4>& node, const wideRay& r, float tNear[4]) {
+    // SSE: four child boxes per instruction.
+    __m128 t0 = _mm_set1_ps(r.tMin);
+    __m128 t1 = _mm_set1_ps(r.tMax);
+    __m128 farScale = _mm_set1_ps(wideBoxFarScale);
+    const float* mins[3] = { node.minX, node.minY, node.minZ };
+    const float* maxs[3] = { node.maxX, node.maxY, node.maxZ };
+
+    for (int a = 0; a < 3; a++) {
+        __m128 origin = _mm_set1_ps(r.origin[a]);
+        __m128 invDirection = _mm_set1_ps(r.invDirection[a]);
+        __m128 originError = _mm_set1_ps(r.originError[a]);
+        const float* nearSlab = r.dirIsNeg[a] ? maxs[a] : mins[a];
+        const float* farSlab = r.dirIsNeg[a] ? mins[a] : maxs[a];
+        __m128 tA = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearSlab), origin), invDirection), originError);
+        __m128 tB = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(farSlab), origin), invDirection), farScale), originError);
+
+        // max/min return their second operand when the first is NaN, so NaN slabs leave t0 and t1 unchanged.
+        t0 = _mm_max_ps(tA, t0);
+        t1 = _mm_min_ps(tB, t1);
+    }
+
+    _mm_storeu_ps(tNear, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+
+RAYTRACER_TARGET_AVX
+inline int intersectChildrenAvx(const wideBvhNode<8>& node, const wideRay& r, float tNear[8]) {
+    // AVX: eight child boxes per instruction.
+    __m256 t0 = _mm256_set1_ps(r.tMin);
+    __m256 t1 = _mm256_set1_ps(r.tMax);
+    __m256 farScale = _mm256_set1_ps(wideBoxFarScale);
+    const float* mins[3] = { node.minX, node.minY, node.minZ };
+    const float* maxs[3] = { node.maxX, node.maxY, node.maxZ };
+
+    for (int a = 0; a < 3; a++) {
+        __m256 origin = _mm256_set1_ps(r.origin[a]);
+        __m256 invDirection = _mm256_set1_ps(r.invDirection[a]);
+        __m256 originError = _mm256_set1_ps(r.originError[a]);
+        const float* nearSlab = r.dirIsNeg[a] ? maxs[a] : mins[a];
+        const float* farSlab = r.dirIsNeg[a] ? mins[a] : maxs[a];
+        __m256 tA = _mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearSlab), origin), invDirection), originError);
+        __m256 tB = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farSlab), origin), invDirection), farScale), originError);
+
+        // max/min return their second operand when the first is NaN, so NaN slabs leave t0 and t1 unchanged.
+        t0 = _mm256_max_ps(tA, t0);
+        t1 = _mm256_min_ps(tB, t1);
+    }
+
+    _mm256_storeu_ps(tNear, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+
+template <>
+inline int intersectChildren<8>(const wideBvhNode<8>& node, const wideRay& r, float tNear[8]) {
+    // wideBvh<8> is only created on AVX hosts (see makeWideBvh), but stay correct elsewhere.
+    static const bool hasAvx = cpuSupportsAvx();
+    if (hasAvx) return intersectChildrenAvx(node, r, tNear);
+
+    int mask = 0;
+    for (int half = 0; half < 2; half++) {
+        wideBvhNode<4> quarter;
+        for (int i = 0; i < 4; i++) {
+            quarter.minX[i] = node.minX[4 * half + i];  quarter.maxX[i] = node.maxX[4 * half + i];
+            quarter.minY[i] = node.minY[4 * half + i];  quarter.maxY[i] = node.maxY[4 * half + i];
+            quarter.minZ[i] = node.minZ[4 * half + i];  quarter.maxZ[i] = node.maxZ[4 * half + i];
+        }
+        mask |= intersectChildren<4>(quarter, r, tNear + 4 * half) << (4 * half);
+    }
+    return mask;
+}
+#endif
+
+template <int width>
+class wideBvh : public hittable {
+    /*
+    * A BVH with `width` (4 or 8) children per node, traversed with one SIMD box test per node.
+    *
+    * It is built from the same primitive list as bvh_node: the binary SAH tree is built first and
+    * then collapsed, repeatedly opening the child with the largest surface area until a node has
+    * `width` children or only leaves are left.
+    */
+  public:
+    wideBvh(const hittableList& list, const bvhBuildSettings& settings = bvhBuildSettings()) {
+        std::vector<aabb> primitiveBounds(list.objects.size());
+        for (size_t i = 0; i < primitiveBounds.size(); i++) {
+            primitiveBounds[i] = list.objects[i]->boundingBox();
+        }
+
+        bvhBuilder builder(settings);
+        builder.build(primitiveBounds);
+
+        primitives.reserve(list.objects.size());
+        for (auto index : builder.primitiveOrder) {
+            primitives.push_back(list.objects[index]);
+        }
+
+        bBox = aabb::empty;
+        for (const auto& box : primitiveBounds) {
+            bBox = aabb(bBox, box);
+        }
+
+        if (!builder.nodes.empty()) {
+            nodes.reserve(builder.nodes.size() / (width - 1) + 1);
+            collapse(builder.nodes);
+        }
+
+        std::clog << "BVH" << width << ": " << primitives.size() << " primitives, " << nodes.size() << " nodes.\n";
+    }
+
+    bool intersect(const ray& r, interval rayT, hitRecord& rec) const override {
+        if (nodes.empty()) return false;
+
+        wideRay wr;
+        for (int a = 0; a < 3; a++) {
+            wr.origin[a] = float(r.origin()[a]);
+            wr.invDirection[a] = float(1.0 / r.direction()[a]);
+            wr.originError[a] = originRoundingError(r.origin()[a], wr.invDirection[a]);
+            wr.dirIsNeg[a] = wr.invDirection[a] < 0;
+        }
+        wr.tMin = roundDownToFloat(rayT.min);
+        wr.tMax = roundUpToFloat(rayT.max);
+
+        // Each stack entry is a child slot still to visit: a node index or a leaf range, and its entry distance.
+        struct stackEntry {
+            uint32_t child;
+            uint16_t count;
+            float tNear;
+        };
+        stackEntry stack[64 * width];
+        int stackSize = 0;
+        stack[stackSize++] = { 0, 0, wr.tMin };
+
+        bool hitAnything = false;
+        float tNear[width];
+
+        while (stackSize > 0) {
+            auto entry = stack[--stackSize];
+            if (entry.tNear > wr.tMax) continue;
+
+            if (entry.count > 0) {
+                for (uint32_t i = 0; i < entry.count; i++) {
+                    if (primitives[entry.child + i]->intersect(r, rayT, rec)) {
+                        hitAnything = true;
+                        rayT.max = rec.t;
+                        wr.tMax = roundUpToFloat(rec.t);
+                    }
+                }
+                continue;
+            }
+
+            const auto& node = nodes[entry.child];
+            countStat(statBvhNodeVisits);
+            countStat(statBoxTests, width);
+            int mask = intersectChildren<width>(node, wr, tNear);
+            if (mask == 0) continue;
+
+            // Push the children hit, farthest first, so the nearest is popped next.
+            int first = stackSize;
+            for (int i = 0; i < width; i++) {
+                if (!(mask & (1 << i))) continue;
+
+                stackEntry child = { node.child[i], node.count[i], tNear[i] };
+                int slot = stackSize++;
+                while (slot > first && stack[slot - 1].tNear < child.tNear) {
+                    stack[slot] = stack[slot - 1];
+                    slot--;
+                }
+                stack[slot] = child;
+            }
+        }
+
+        return hitAnything;
+    }
+
+    aabb boundingBox() const override { return bBox; }
+
+  private:
+    std::vector<wideBvhNode<width>> nodes;
+    std::vector<shared_ptr<hittable>> primitives;
+    aabb bBox;
+
+    static double nodeArea(const linearBvhNode& node) {
+        double dx = node.boundsMax[0] - node.boundsMin[0];
+        double dy = node.boundsMax[1] - node.boundsMin[1];
+        double dz = node.boundsMax[2] - node.boundsMin[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    void collapse(const std::vector<linearBvhNode>& binary) {
+        // Wide node i is built from binary node sources[i]. Children are gathered breadth first, so the root is node 0.
+        std::vector<uint32_t> sources = { 0 };
+        nodes.emplace_back();
+
+        for (size_t wideIndex = 0; wideIndex < sources.size(); wideIndex++) {
+            const auto& source = binary[sources[wideIndex]];
+
+            std::vector<uint32_t> children;
+            if (source.isLeaf()) {
+                children.push_back(sources[wideIndex]);
+            } else {
+                children.push_back(sources[wideIndex] + 1);
+                children.push_back(source.offset);
+            }
+
+            // Open the largest interior child until the node is full.
+            while (int(children.size()) < width) {
+                int largest = -1;
+                double largestArea = -1;
+                for (int i = 0; i < int(children.size()); i++) {
+                    const auto& candidate = binary[children[i]];
+                    if (!candidate.isLeaf() && nodeArea(candidate) > largestArea) {
+                        largest = i;
+                        largestArea = nodeArea(candidate);
+                    }
+                }
+                if (largest < 0) break;
+
+                auto opened = children[largest];
+                children[largest] = opened + 1;
+                children.push_back(binary[opened].offset);
+            }
+
+            wideBvhNode<width> node;
+            for (int i = 0; i < int(children.size()); i++) {
+                const auto& childNode = binary[children[i]];
+                node.minX[i] = childNode.boundsMin[0];  node.maxX[i] = childNode.boundsMax[0];
+                node.minY[i] = childNode.boundsMin[1];  node.maxY[i] = childNode.boundsMax[1];
+                node.minZ[i] = childNode.boundsMin[2];  node.maxZ[i] = childNode.boundsMax[2];
+
+                if (childNode.isLeaf()) {
+                    node.child[i] = childNode.offset;
+                    node.count[i] = childNode.primitiveCount;
+                } else {
+                    node.child[i] = uint32_t(sources.size());
+                    node.count[i] = 0;
+                    sources.push_back(children[i]);
+                    nodes.emplace_back();
+                }
+            }
+            nodes[wideIndex] = node;
+        }
+    }
+};
+
+using bvh4 = wideBvh<4>;
+using bvh8 = wideBvh<8>;
+
+inline shared_ptr<hittable> makeWideBvh(const hittableList& list, const bvhBuildSettings& settings = bvhBuildSettings()) {
+    // Use 8-wide nodes where the host CPU has AVX, otherwise 4-wide nodes with SSE box tests.
+    if (cpuSupportsAvx()) return make_shared<bvh8>(list, settings);
+    return make_shared<bvh4>(list, settings);
+}
+
+#endif